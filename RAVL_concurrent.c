@@ -0,0 +1,550 @@
+/*
+ *  A concurrent RAVL tree: optimistic readers, writers that lock only the
+ *  nodes they change.
+ *
+ *  Every node has a version lock: bit 0 is a spin lock that writers take
+ *  hand over hand on their way down, bit 1 is set while a writer changes
+ *  the node's children, and the remaining bits count those changes. A
+ *  reader reads a node's version, its fields and then the version of the
+ *  child it moves to, and restarts if the node's version changed in the
+ *  meantime. A sentinel node whose left child is the root lets the root
+ *  pointer be locked and versioned like any other child pointer.
+ *
+ *  A writer adds its size delta (+1 or -1) to each node as it locks it,
+ *  while it still holds the parent, so every node above the point it has
+ *  reached already counts its change and every node below does not yet.
+ *  Rotations recompute sizes from the children of locked nodes, which no
+ *  other writer can be changing, so they keep that invariant. AVL
+ *  rebalancing never goes above the deepest node on the path whose height
+ *  cannot change (for an insert, one whose children differ in height; for
+ *  a delete, one whose children do not), so a writer unlocks everything
+ *  above that node's parent as soon as it passes it.
+ *
+ *  The delta depends on whether the key is already there, so a writer
+ *  first takes the stripe lock its key hashes to (no other writer can add
+ *  or remove the key meanwhile) and looks the key up optimistically.
+ *
+ *  Locks are only ever taken on a child of a node the thread already
+ *  holds (or on the sentinel), so no two writers can wait for each other.
+ */
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <sched.h>
+
+#include "RAVL_concurrent.h"
+
+// reads or writes a node field that other threads may be reading
+#define LOAD(field) __atomic_load_n(&(field), __ATOMIC_RELAXED)
+#define STORE(field, v) __atomic_store_n(&(field), (v), __ATOMIC_RELAXED)
+// reads or writes a pointer to a node or value, publishing what it points to
+#define FOLLOW(field) __atomic_load_n(&(field), __ATOMIC_ACQUIRE)
+#define LINK(field, v) __atomic_store_n(&(field), (v), __ATOMIC_RELEASE)
+
+#define LOCKED 1u    // version bit: a writer holds the node
+#define CHANGING 2u  // version bit: the node's children are being changed
+#define VERSION 4u   // version step per change
+
+#define SPINS 64  // failed lock attempts before a writer starts yielding
+
+#define Q_SEARCH 0
+#define Q_RANK 1
+#define Q_FIND_RANK 2
+
+typedef struct ctree_query {
+  int op;          // Q_SEARCH, Q_RANK or Q_FIND_RANK
+  int arg;         // the key, or the rank for Q_FIND_RANK
+  int found;
+  int key;
+  int rank;
+  void* value;
+  RAVL_Node* node;  // the node that answered the query
+} CTreeQuery;
+
+typedef struct ctree_path {
+  RAVL_Node* nodes[MAX_HEIGHT + 2];  // nodes locked on the way down, sentinel first
+  int first;                         // index of the topmost node still locked
+  int n;
+} CTreePath;
+
+struct ravl_ctree {
+  RAVL_Node head;                          // sentinel; its left child is the root
+  pthread_mutex_t stripes[CTREE_STRIPES];  // writer locks, by hash of the key
+  RAVL_Epoch* epoch;
+};
+
+/*************************************************************************
+ ** Helper functions
+ *************************************************************************/
+
+int loadSize(RAVL_Node *node) { return node == NULL ? 0 : LOAD(node->size); }
+
+int loadHeight(RAVL_Node *node) { return node == NULL ? 0 : LOAD(node->height); }
+
+/* Returns the stripe lock of 'tree' that 'key' hashes to. */
+pthread_mutex_t *stripe(RAVL_CTree *tree, int key) {
+  return &tree->stripes[((unsigned)key * 2654435761u) % CTREE_STRIPES];
+}
+
+void lockNode(RAVL_Node *node) {
+  for (int spins = 0;; spins++) {
+    unsigned v = LOAD(node->version);
+    if (!(v & LOCKED) && __atomic_compare_exchange_n(&node->version, &v, v | LOCKED, 0,
+                                                     __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+      return;
+    }
+    if (spins >= SPINS) {
+      sched_yield();
+    }
+  }
+}
+
+void unlockNode(RAVL_Node *node) { __atomic_fetch_and(&node->version, ~LOCKED, __ATOMIC_RELEASE); }
+
+/* Marks 'node', which the caller holds, as having its children changed:
+ * readers that reach it restart until endChange().
+ */
+void beginChange(RAVL_Node *node) {
+  STORE(node->version, LOAD(node->version) | CHANGING);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+void endChange(RAVL_Node *node) {
+  __atomic_store_n(&node->version, (LOAD(node->version) + VERSION) & ~CHANGING,
+                   __ATOMIC_RELEASE);
+}
+
+/* Returns the version of 'node' as a reader sees it. It has CHANGING set if
+ * the reader cannot use the node now.
+ */
+unsigned readVersion(RAVL_Node *node) {
+  return __atomic_load_n(&node->version, __ATOMIC_ACQUIRE) & ~LOCKED;
+}
+
+/* Returns 1 if 'node' is still at version 'v', so that what was read from
+ * it since readVersion() returned 'v' is consistent, and 0 otherwise.
+ */
+int validate(RAVL_Node *node, unsigned v) {
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  return (LOAD(node->version) & ~LOCKED) == v;
+}
+
+/* Moves query 'q' on from 'node', where 'r' keys are known to be smaller
+ * than the subtree rooted at 'node'. Returns the child to go to, or NULL
+ * if the walk ends at 'node' (with q->found set if 'node' answers 'q').
+ */
+RAVL_Node *step(RAVL_Node *node, CTreeQuery *q, int *r) {
+  int key = LOAD(node->key);
+  RAVL_Node *left = FOLLOW(node->left);
+  int here = *r + loadSize(left) + 1;  // rank of 'node'
+
+  if (q->op == Q_FIND_RANK ? here == q->arg : key == q->arg) {
+    q->found = 1;
+    q->key = key;
+    q->rank = here;
+    q->value = FOLLOW(node->value);
+    q->node = node;
+    return NULL;
+  }
+  if (q->op == Q_FIND_RANK ? q->arg > here : q->arg > key) {
+    *r = here;
+    return FOLLOW(node->right);
+  }
+  return left;
+}
+
+/* Answers query 'q' by walking 'tree' without locks. Returns 0 if a writer
+ * changed a node on the way, 1 otherwise.
+ */
+int walkTree(RAVL_CTree *tree, CTreeQuery *q) {
+  RAVL_Node *parent = &tree->head;
+  unsigned pv = readVersion(parent);
+  int r = 0;  // keys known to be smaller than the current subtree
+
+  q->found = 0;
+  if (pv & CHANGING) {
+    return 0;
+  }
+  RAVL_Node *node = FOLLOW(parent->left);
+  while (node != NULL) {
+    unsigned v = readVersion(node);
+    if ((v & CHANGING) || !validate(parent, pv)) {
+      return 0;
+    }
+    parent = node;
+    pv = v;
+    node = step(node, q, &r);
+  }
+  return validate(parent, pv);
+}
+
+/* Answers query 'q' by walking 'tree' hand over hand with node locks. */
+void lockedWalk(RAVL_CTree *tree, CTreeQuery *q) {
+  RAVL_Node *parent = &tree->head;
+  int r = 0;
+
+  q->found = 0;
+  lockNode(parent);
+  RAVL_Node *node = parent->left;
+  while (node != NULL) {
+    lockNode(node);
+    unlockNode(parent);
+    parent = node;
+    node = step(node, q, &r);
+  }
+  unlockNode(parent);
+}
+
+/* Answers query 'q' on 'tree', optimistically if possible. The caller is
+ * in a read section.
+ */
+void readTree(RAVL_CTree *tree, CTreeQuery *q) {
+  for (int attempt = 0; attempt < CTREE_RETRIES; attempt++) {
+    if (walkTree(tree, q)) {
+      return;
+    }
+    sched_yield();  // a writer is in the middle of a change
+  }
+  lockedWalk(tree, q);
+}
+
+/* Adds locked node 'node' to the bottom of 'path'. If 'safe', nothing
+ * above 'node' but sizes will change, so the nodes above its parent are
+ * unlocked.
+ */
+void pushNode(CTreePath *path, RAVL_Node *node, int safe) {
+  if (safe) {
+    while (path->first < path->n - 1) {
+      unlockNode(path->nodes[path->first++]);
+    }
+  }
+  path->nodes[path->n++] = node;
+}
+
+void unlockPath(CTreePath *path) {
+  while (path->first < path->n) {
+    unlockNode(path->nodes[path->first++]);
+  }
+}
+
+/* Returns 1 if 'node' is on 'path' below index 'i' (so already locked). */
+int onPath(CTreePath *path, int i, RAVL_Node *node) {
+  for (int j = i + 1; j < path->n; j++) {
+    if (path->nodes[j] == node) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/* Updates the height and size of locked node 'node' from its children. */
+void fixNode(RAVL_Node *node) {
+  int lh = loadHeight(node->left);
+  int rh = loadHeight(node->right);
+  STORE(node->height, (lh > rh ? lh : rh) + 1);
+  STORE(node->size, loadSize(node->left) + loadSize(node->right) + 1);
+}
+
+/* Makes 'parent' point to 'to' where it pointed to 'from'. */
+void relink(RAVL_Node *parent, RAVL_Node *from, RAVL_Node *to) {
+  if (parent->left == from) {
+    LINK(parent->left, to);
+  } else {
+    LINK(parent->right, to);
+  }
+}
+
+/* Rotates 'child' above 'node', its parent, as rightRotation() or
+ * leftRotation() do. Both are locked and marked as changing. Returns
+ * 'child'.
+ */
+RAVL_Node *rotateUp(RAVL_Node *node, RAVL_Node *child) {
+  if (child == node->left) {
+    LINK(node->left, child->right);
+    LINK(child->right, node);
+  } else {
+    LINK(node->right, child->left);
+    LINK(child->left, node);
+  }
+  fixNode(node);
+  fixNode(child);
+  return child;
+}
+
+/* Rebalances the subtree rooted at path->nodes[i], as rebalance() does,
+ * locking the children it rotates that are not on 'path'.
+ */
+void restoreNode(CTreePath *path, int i) {
+  RAVL_Node *node = path->nodes[i];
+  int balance = loadHeight(node->left) - loadHeight(node->right);
+  if (balance > -2 && balance < 2) {
+    fixNode(node);
+    return;
+  }
+
+  RAVL_Node *child = balance > 0 ? node->left : node->right;
+  int lock_child = !onPath(path, i, child);
+  if (lock_child) {
+    lockNode(child);
+  }
+  int lean = loadHeight(child->left) - loadHeight(child->right);
+  RAVL_Node *grand = NULL;  // set for a double rotation
+  if (balance > 0 ? lean < 0 : lean > 0) {
+    grand = balance > 0 ? child->right : child->left;
+  }
+  int lock_grand = grand != NULL && !onPath(path, i, grand);
+  if (lock_grand) {
+    lockNode(grand);
+  }
+
+  RAVL_Node *parent = path->nodes[i - 1];
+  RAVL_Node *changed[4] = {parent, node, child, grand};
+  int n = grand == NULL ? 3 : 4;
+  for (int j = 0; j < n; j++) {
+    beginChange(changed[j]);
+  }
+  if (grand != NULL) {
+    relink(node, child, rotateUp(child, grand));
+    relink(parent, node, rotateUp(node, grand));
+  } else {
+    relink(parent, node, rotateUp(node, child));
+  }
+  for (int j = 0; j < n; j++) {
+    endChange(changed[j]);
+  }
+
+  if (lock_grand) {
+    unlockNode(grand);
+  }
+  if (lock_child) {
+    unlockNode(child);
+  }
+}
+
+/* Restores heights, sizes and balance bottom up along 'path' after a
+ * change at its bottom. The topmost locked node keeps its height; only its
+ * child link may change.
+ */
+void restorePath(CTreePath *path) {
+  for (int i = path->n - 1; i > path->first; i--) {
+    restoreNode(path, i);
+  }
+}
+
+/* Links node 'fresh' into 'tree', which does not hold its key. */
+void insertAbsent(RAVL_CTree *tree, RAVL_Node *fresh) {
+  CTreePath path = {{&tree->head}, 0, 1};
+  int key = fresh->key;
+
+  lockNode(&tree->head);
+  RAVL_Node *node = tree->head.left;
+  while (node != NULL) {
+    lockNode(node);
+    STORE(node->size, node->size + 1);
+    pushNode(&path, node, loadHeight(node->left) != loadHeight(node->right));
+    node = key < node->key ? node->left : node->right;
+  }
+
+  RAVL_Node *parent = path.nodes[path.n - 1];
+  beginChange(parent);
+  if (parent == &tree->head || key < parent->key) {
+    LINK(parent->left, fresh);
+  } else {
+    LINK(parent->right, fresh);
+  }
+  endChange(parent);
+
+  restorePath(&path);
+  unlockPath(&path);
+}
+
+/* Unlinks the node holding 'key' from 'tree', which holds it, and returns
+ * that node. As delete() does, a node with two children is replaced by its
+ * successor node rather than by a copy of its key.
+ */
+RAVL_Node *deletePresent(RAVL_CTree *tree, int key) {
+  CTreePath path = {{&tree->head}, 0, 1};
+  int target = -1;  // index of the node holding 'key' on 'path'
+
+  lockNode(&tree->head);
+  RAVL_Node *node = tree->head.left;
+  while (node != NULL) {
+    lockNode(node);
+    STORE(node->size, node->size - 1);
+
+    int leaving = node->key == key && (node->left == NULL || node->right == NULL);
+    int safe = target < 0 && !leaving && loadHeight(node->left) == loadHeight(node->right);
+    pushNode(&path, node, safe);
+
+    if (target >= 0) {  // on the way to the successor
+      node = node->left;
+    } else if (node->key == key) {
+      target = path.n - 1;
+      node = leaving ? NULL : node->right;
+    } else {
+      node = key < node->key ? node->left : node->right;
+    }
+  }
+
+  RAVL_Node *removed = path.nodes[target];
+  RAVL_Node *parent = path.nodes[target - 1];
+  if (target == path.n - 1) {
+    RAVL_Node *child = removed->left != NULL ? removed->left : removed->right;
+    beginChange(parent);
+    beginChange(removed);
+    relink(parent, removed, child);
+    endChange(removed);
+    endChange(parent);
+    path.n--;
+  } else {
+    RAVL_Node *succ = path.nodes[path.n - 1];
+    RAVL_Node *succ_parent = path.nodes[path.n - 2];
+    beginChange(parent);
+    beginChange(removed);
+    beginChange(succ);
+    if (succ_parent != removed) {
+      beginChange(succ_parent);
+      LINK(succ_parent->left, succ->right);
+      LINK(succ->right, removed->right);
+    }
+    LINK(succ->left, removed->left);
+    relink(parent, removed, succ);
+    if (succ_parent != removed) {
+      endChange(succ_parent);
+    }
+    endChange(succ);
+    endChange(removed);
+    endChange(parent);
+    path.nodes[target] = succ;
+    path.n--;
+  }
+  unlockNode(removed);
+
+  restorePath(&path);
+  unlockPath(&path);
+  return removed;
+}
+
+/* Retires every node of the tree rooted at 'node' through 'epoch'. */
+void retireTree(RAVL_Epoch *epoch, RAVL_Node *node) {
+  if (node == NULL) {
+    return;
+  }
+  retireTree(epoch, node->left);
+  retireTree(epoch, node->right);
+  epochRetire(epoch, node);
+}
+
+/*************************************************************************
+ ** Concurrent tree functions
+ *************************************************************************/
+
+RAVL_CTree *ctreeCreate(RAVL_Epoch *epoch) {
+  RAVL_CTree *tree = (RAVL_CTree *)calloc(1, sizeof(RAVL_CTree));
+  if (tree == NULL) {
+    return NULL;
+  }
+
+  for (int i = 0; i < CTREE_STRIPES; i++) {
+    pthread_mutex_init(&tree->stripes[i], NULL);
+  }
+  tree->epoch = epoch;
+  return tree;
+}
+
+void ctreeInsert(RAVL_CTree *tree, int key, void *value) {
+  CTreeQuery q = {Q_SEARCH, key, 0, 0, 0, NULL, NULL};
+  pthread_mutex_t *lock = stripe(tree, key);
+
+  pthread_mutex_lock(lock);
+  epochEnter(tree->epoch);
+  readTree(tree, &q);
+  if (q.found) {
+    LINK(q.node->value, value);
+  } else {
+    RAVL_Allocator *from = epochAllocator(tree->epoch);
+    RAVL_Node *fresh = (RAVL_Node *)from->alloc(from->ctx);
+    if (fresh != NULL) {
+      STORE(fresh->key, key);
+      STORE(fresh->version, 0);
+      STORE(fresh->value, value);
+      STORE(fresh->height, 1);
+      STORE(fresh->size, 1);
+      STORE(fresh->left, NULL);
+      STORE(fresh->right, NULL);
+      insertAbsent(tree, fresh);
+    }
+  }
+  epochExit(tree->epoch);
+  pthread_mutex_unlock(lock);
+}
+
+void ctreeDelete(RAVL_CTree *tree, int key) {
+  CTreeQuery q = {Q_SEARCH, key, 0, 0, 0, NULL, NULL};
+  pthread_mutex_t *lock = stripe(tree, key);
+  RAVL_Node *removed = NULL;
+
+  pthread_mutex_lock(lock);
+  epochEnter(tree->epoch);
+  readTree(tree, &q);
+  if (q.found) {
+    removed = deletePresent(tree, key);
+  }
+  epochExit(tree->epoch);
+  pthread_mutex_unlock(lock);
+
+  if (removed != NULL) {
+    epochRetire(tree->epoch, removed);
+  }
+}
+
+int ctreeSearch(RAVL_CTree *tree, int key, void **value) {
+  CTreeQuery q = {Q_SEARCH, key, 0, 0, 0, NULL, NULL};
+  epochEnter(tree->epoch);
+  readTree(tree, &q);
+  epochExit(tree->epoch);
+  if (q.found && value != NULL) {
+    *value = q.value;
+  }
+  return q.found;
+}
+
+int ctreeRank(RAVL_CTree *tree, int key) {
+  CTreeQuery q = {Q_RANK, key, 0, 0, 0, NULL, NULL};
+  epochEnter(tree->epoch);
+  readTree(tree, &q);
+  epochExit(tree->epoch);
+  return q.found ? q.rank : NOTIN;
+}
+
+int ctreeFindRank(RAVL_CTree *tree, int rank, int *key, void **value) {
+  CTreeQuery q = {Q_FIND_RANK, rank, 0, 0, 0, NULL, NULL};
+  epochEnter(tree->epoch);
+  readTree(tree, &q);
+  epochExit(tree->epoch);
+  if (q.found) {
+    *key = q.key;
+    if (value != NULL) {
+      *value = q.value;
+    }
+  }
+  return q.found;
+}
+
+int ctreeSize(RAVL_CTree *tree) {
+  epochEnter(tree->epoch);
+  int n = loadSize(FOLLOW(tree->head.left));
+  epochExit(tree->epoch);
+  return n;
+}
+
+void ctreeDestroy(RAVL_CTree *tree) {
+  if (tree == NULL) {
+    return;
+  }
+  retireTree(tree->epoch, tree->head.left);
+  for (int i = 0; i < CTREE_STRIPES; i++) {
+    pthread_mutex_destroy(&tree->stripes[i]);
+  }
+  free(tree);
+}
@@ -0,0 +1,68 @@
+/*
+ *  Header file for a concurrent RAVL tree.
+ *
+ *  Readers never lock: they walk the tree optimistically, validating each
+ *  node against its version as they leave it, and retry if a writer
+ *  changed it (walking with node locks only after CTREE_RETRIES failed
+ *  attempts). Writers lock only the nodes they may change, so writers
+ *  working in disjoint subtrees run in parallel. Nodes removed by a writer
+ *  are retired through an epoch domain, so a reader that is still looking
+ *  at one never sees freed memory.
+ *
+ *  Sizes are exact whenever no writer is active; a rank or size read while
+ *  writers are active counts each unfinished insert or delete either as
+ *  done or as not yet started.
+ *
+ *  Setup: create an epoch domain and have every thread that uses the tree
+ *  call epochRegister(epoch) first. The tree takes its nodes from
+ *  epochAllocator(epoch) itself.
+*/
+
+#include "RAVL_epoch.h"
+#include "RAVL_tree.h"
+
+#ifndef __RAVL_concurrent_header
+#define __RAVL_concurrent_header
+
+#define CTREE_RETRIES 8   // optimistic attempts before a reader locks
+#define CTREE_STRIPES 64  // writer locks that keys are hashed to
+
+typedef struct ravl_ctree RAVL_CTree;
+
+/* Returns a new, empty concurrent tree whose nodes are retired through
+ * 'epoch'. Returns NULL if memory runs out.
+*/
+RAVL_CTree* ctreeCreate(RAVL_Epoch* epoch);
+
+/* Inserts 'key'/'value' into 'tree', as insert() does.
+*/
+void ctreeInsert(RAVL_CTree* tree, int key, void* value);
+
+/* Deletes 'key' from 'tree', as delete() does.
+*/
+void ctreeDelete(RAVL_CTree* tree, int key);
+
+/* Returns 1 and stores the value associated with 'key' in 'value' (if it
+ * is not NULL) if 'key' is in 'tree'. Returns 0 otherwise.
+*/
+int ctreeSearch(RAVL_CTree* tree, int key, void** value);
+
+/* Returns the rank of 'key' in 'tree', or NOTIN if 'key' is not in it.
+*/
+int ctreeRank(RAVL_CTree* tree, int key);
+
+/* Stores the key with rank 'rank' in 'tree' in 'key', and its value in
+ * 'value' if it is not NULL. Returns 1 if there is such a rank, and 0
+ * (storing nothing) otherwise.
+*/
+int ctreeFindRank(RAVL_CTree* tree, int rank, int* key, void** value);
+
+/* Returns the number of keys in 'tree'.
+*/
+int ctreeSize(RAVL_CTree* tree);
+
+/* Frees 'tree' and its nodes. No other thread may be using it.
+*/
+void ctreeDestroy(RAVL_CTree* tree);
+
+#endif
@@ -0,0 +1,159 @@
+/*
+ *  Stress test for the concurrent RAVL tree.
+ *
+ *  Usage: RAVL_concurrent_tester [writers [operations per writer]]
+ *
+ *  Each writer inserts and deletes random keys of its own residue class
+ *  modulo the number of writers, so the final contents are known, and now
+ *  and then a key of a small shared range, so writers also race on the
+ *  same keys. Two readers query the tree meanwhile. At the end the tree
+ *  must hold exactly the expected keys and every rank must round-trip
+ *  through ctreeFindRank() and ctreeRank(). Prints the writers' throughput;
+ *  exits with status 1 on the first failure. Set RAVL_TEST_SEED to vary the
+ *  random keys.
+ *
+ *  Build: gcc -O2 RAVL_concurrent_tester.c RAVL_concurrent.c RAVL_epoch.c
+ *         RAVL_tree.c -pthread
+ */
+#define _GNU_SOURCE
+#include <pthread.h>
+
+#include "RAVL_concurrent.h"
+#include "RAVL_test.h"
+
+#define KEYS 4000   // keys per writer
+#define SHARED 64   // keys -1 .. -SHARED are shared by all writers
+#define READERS 2
+
+RAVL_Epoch* epoch;
+RAVL_CTree* tree;
+int writers;
+long operations;
+char* present;  // present[w * KEYS + j]: key j * writers + w is in the tree
+int stop;
+
+void* writeKeys(void* arg);
+void* readKeys(void* arg);
+void checkTree(void);
+
+int main(int argc, char* argv[]) {
+  testSeed();
+  writers = argc > 1 ? atoi(argv[1]) : 4;
+  operations = argc > 2 ? atol(argv[2]) : 200000;
+  if (writers < 1) {
+    fprintf(stderr, "need at least one writer\n");
+    return 1;
+  }
+
+  epoch = epochCreate(NULL);
+  tree = ctreeCreate(epoch);
+  present = (char*)calloc((size_t)writers * KEYS, 1);
+  CHECK(epoch != NULL && tree != NULL && present != NULL);
+
+  pthread_t threads[writers + READERS];
+  double start = testNow();
+  for (long i = 0; i < writers; i++) {
+    pthread_create(&threads[i], NULL, writeKeys, (void*)i);
+  }
+  for (int i = 0; i < READERS; i++) {
+    pthread_create(&threads[writers + i], NULL, readKeys, NULL);
+  }
+  for (int i = 0; i < writers; i++) {
+    pthread_join(threads[i], NULL);
+  }
+  double seconds = testNow() - start;
+  __atomic_store_n(&stop, 1, __ATOMIC_RELAXED);
+  for (int i = 0; i < READERS; i++) {
+    pthread_join(threads[writers + i], NULL);
+  }
+
+  printf("%d writers: %.0f updates/s\n", writers, writers * operations / seconds);
+
+  epochRegister(epoch);
+  checkTree();
+  ctreeDestroy(tree);
+  epochUnregister(epoch);
+  epochDestroy(epoch);
+  free(present);
+  printf("ok\n");
+  return 0;
+}
+
+void* writeKeys(void* arg) {
+  long w = (long)arg;
+  unsigned seed = test_seed * 1000 + (unsigned)w;
+
+  epochRegister(epoch);
+  for (long i = 0; i < operations; i++) {
+    unsigned r = testRandom(&seed);
+    int j = r % KEYS;
+    int key = j * writers + (int)w;
+    if (r >> 23) {
+      ctreeInsert(tree, key, (void*)(long)key);
+      present[w * KEYS + j] = 1;
+    } else {
+      ctreeDelete(tree, key);
+      present[w * KEYS + j] = 0;
+    }
+
+    if (i % 8 == 0) {
+      r = testRandom(&seed);
+      int shared = -1 - (int)(r % SHARED);
+      if (r >> 23) {
+        ctreeInsert(tree, shared, NULL);
+      } else {
+        ctreeDelete(tree, shared);
+      }
+    }
+  }
+  epochUnregister(epoch);
+  return NULL;
+}
+
+void* readKeys(void* arg) {
+  unsigned seed = test_seed * 1000 + 999;
+  (void)arg;
+
+  epochRegister(epoch);
+  while (!__atomic_load_n(&stop, __ATOMIC_RELAXED)) {
+    int key = testRandom(&seed) % (KEYS * writers);
+    void* value;
+    if (ctreeSearch(tree, key, &value)) {
+      CHECK((long)value == key);
+    }
+    int r = ctreeRank(tree, key);
+    CHECK(r == NOTIN || r >= 1);
+    int smallest;
+    if (ctreeFindRank(tree, 1, &smallest, NULL)) {
+      CHECK(smallest >= -SHARED);
+    }
+  }
+  epochUnregister(epoch);
+  return NULL;
+}
+
+void checkTree(void) {
+  int n = 0;
+  for (int w = 0; w < writers; w++) {
+    for (int j = 0; j < KEYS; j++) {
+      int in = ctreeSearch(tree, j * writers + w, NULL);
+      CHECK(in == present[w * KEYS + j]);
+      n += in;
+    }
+  }
+  for (int key = -SHARED; key < 0; key++) {
+    n += ctreeSearch(tree, key, NULL);
+  }
+  CHECK(ctreeSize(tree) == n);
+
+  int previous = -SHARED - 1;
+  for (int r = 1; r <= n; r++) {
+    int key;
+    CHECK(ctreeFindRank(tree, r, &key, NULL));
+    CHECK(key > previous);
+    CHECK(ctreeRank(tree, key) == r);
+    previous = key;
+  }
+  int key;
+  CHECK(!ctreeFindRank(tree, n + 1, &key, NULL));
+}
@@ -0,0 +1,284 @@
+/*
+ *  Epoch-based reclamation of RAVL tree nodes.
+ *
+ *  The domain has a global epoch counter. A thread in a read section
+ *  publishes the epoch it saw on entry; the global epoch only advances when
+ *  every active thread has seen the current one. A node retired during
+ *  epoch e is therefore unreachable by every reader once the global epoch
+ *  reaches e + 2. Each thread keeps three limbo lists, indexed by epoch
+ *  modulo 3, so a list is always safe to empty by the time it is reused.
+ */
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+
+#include "RAVL_epoch.h"
+
+typedef struct limbo {
+  RAVL_Node** nodes;    // retired nodes (their fields may still be read)
+  int n;
+  int cap;
+  unsigned long epoch;  // epoch the nodes were retired in
+} Limbo;
+
+typedef struct epoch_thread {
+  struct epoch_thread* next;
+  atomic_ulong state;   // (epoch seen on entry << 1) | in read section
+  Limbo limbo[3];
+  int retired;          // nodes retired since the last reclaim attempt
+} EpochThread;
+
+struct ravl_epoch {
+  atomic_ulong global;
+  pthread_mutex_t threads_lock;  // guards 'threads' and 'orphans'
+  EpochThread* threads;
+  Limbo orphans;                 // nodes left by unregistered threads
+  pthread_mutex_t backing_lock;  // serializes calls to 'backing'
+  RAVL_Allocator* backing;
+  RAVL_Allocator allocator;
+};
+
+static __thread EpochThread *self = NULL;  // this thread's record
+
+/*************************************************************************
+ ** Helper functions
+ *************************************************************************/
+
+/* Appends 'node' to 'l'. Returns -1 if memory runs out, 0 otherwise. */
+int limboPush(Limbo *l, RAVL_Node *node) {
+  if (l->n == l->cap) {
+    int cap = l->cap == 0 ? EPOCH_BATCH : 2 * l->cap;
+    RAVL_Node **nodes = (RAVL_Node **)realloc(l->nodes, cap * sizeof(RAVL_Node *));
+    if (nodes == NULL) {
+      return -1;
+    }
+    l->nodes = nodes;
+    l->cap = cap;
+  }
+  l->nodes[l->n++] = node;
+  return 0;
+}
+
+/* Returns every node in 'l' to the backing allocator of 'epoch' as one
+ * batch, leaving 'l' empty.
+ */
+void limboFree(RAVL_Epoch *epoch, Limbo *l) {
+  if (l->n == 0) {
+    return;
+  }
+
+  pthread_mutex_lock(&epoch->backing_lock);
+  for (int i = 0; i < l->n; i++) {
+    if (epoch->backing == NULL) {
+      free(l->nodes[i]);
+    } else {
+      epoch->backing->release(epoch->backing->ctx, l->nodes[i]);
+    }
+  }
+  pthread_mutex_unlock(&epoch->backing_lock);
+  l->n = 0;
+}
+
+/* Advances the global epoch of 'epoch' if every thread in a read section
+ * has seen the current one, and frees the orphans if that made them safe.
+ * Returns the global epoch.
+ */
+unsigned long tryAdvance(RAVL_Epoch *epoch) {
+  pthread_mutex_lock(&epoch->threads_lock);
+  unsigned long e = atomic_load(&epoch->global);
+  int ok = 1;
+
+  for (EpochThread *t = epoch->threads; t != NULL && ok; t = t->next) {
+    unsigned long s = atomic_load(&t->state);
+    if ((s & 1) && (s >> 1) != e) {
+      ok = 0;
+    }
+  }
+  if (ok && atomic_compare_exchange_strong(&epoch->global, &e, e + 1)) {
+    e++;
+  }
+  if (epoch->orphans.epoch + 2 <= e) {
+    limboFree(epoch, &epoch->orphans);
+  }
+  pthread_mutex_unlock(&epoch->threads_lock);
+  return e;
+}
+
+/* Returns 'node', retired in epoch 'e', to the backing allocator as soon as
+ * that is safe. Used only when a limbo list cannot grow; the calling thread
+ * must not be in a read section.
+ */
+void waitAndFree(RAVL_Epoch *epoch, RAVL_Node *node, unsigned long e) {
+  Limbo one = {&node, 1, 1, e};
+  while (tryAdvance(epoch) < e + 2) {
+    sched_yield();
+  }
+  limboFree(epoch, &one);
+}
+
+void *epochAlloc(void *ctx) {
+  RAVL_Epoch *epoch = (RAVL_Epoch *)ctx;
+  void *node;
+
+  pthread_mutex_lock(&epoch->backing_lock);
+  if (epoch->backing == NULL) {
+    node = malloc(sizeof(RAVL_Node));
+  } else {
+    node = epoch->backing->alloc(epoch->backing->ctx);
+  }
+  pthread_mutex_unlock(&epoch->backing_lock);
+  return node;
+}
+
+void epochRelease(void *ctx, void *node) { epochRetire((RAVL_Epoch *)ctx, (RAVL_Node *)node); }
+
+/*************************************************************************
+ ** Epoch functions
+ *************************************************************************/
+
+RAVL_Epoch *epochCreate(RAVL_Allocator *backing) {
+  RAVL_Epoch *epoch = (RAVL_Epoch *)calloc(1, sizeof(RAVL_Epoch));
+  if (epoch == NULL) {
+    return NULL;
+  }
+
+  atomic_init(&epoch->global, 2);  // so that 'epoch - 2' never wraps
+  pthread_mutex_init(&epoch->threads_lock, NULL);
+  pthread_mutex_init(&epoch->backing_lock, NULL);
+  epoch->backing = backing;
+  epoch->allocator.alloc = epochAlloc;
+  epoch->allocator.release = epochRelease;
+  epoch->allocator.ctx = epoch;
+  return epoch;
+}
+
+int epochRegister(RAVL_Epoch *epoch) {
+  EpochThread *t = (EpochThread *)calloc(1, sizeof(EpochThread));
+  if (t == NULL) {
+    return -1;
+  }
+  atomic_init(&t->state, 0);
+
+  pthread_mutex_lock(&epoch->threads_lock);
+  t->next = epoch->threads;
+  epoch->threads = t;
+  pthread_mutex_unlock(&epoch->threads_lock);
+  self = t;
+  return 0;
+}
+
+void epochUnregister(RAVL_Epoch *epoch) {
+  EpochThread *t = self;
+  if (t == NULL) {
+    return;
+  }
+
+  pthread_mutex_lock(&epoch->threads_lock);
+  EpochThread **p = &epoch->threads;
+  while (*p != t) {
+    p = &(*p)->next;
+  }
+  *p = t->next;
+
+  // the orphans become safe two epochs after the newest of them
+  unsigned long e = atomic_load(&epoch->global);
+  epoch->orphans.epoch = e;
+  for (int b = 0; b < 3; b++) {
+    int kept = 0;  // nodes the orphan list had no room for
+    for (int i = 0; i < t->limbo[b].n; i++) {
+      if (limboPush(&epoch->orphans, t->limbo[b].nodes[i]) != 0) {
+        t->limbo[b].nodes[kept++] = t->limbo[b].nodes[i];
+      }
+    }
+    t->limbo[b].n = kept;
+  }
+  pthread_mutex_unlock(&epoch->threads_lock);
+
+  for (int b = 0; b < 3; b++) {
+    if (t->limbo[b].n > 0) {
+      while (tryAdvance(epoch) < e + 2) {
+        sched_yield();
+      }
+      limboFree(epoch, &t->limbo[b]);
+    }
+    free(t->limbo[b].nodes);
+  }
+  free(t);
+  self = NULL;
+}
+
+void epochEnter(RAVL_Epoch *epoch) {
+  unsigned long e = atomic_load(&epoch->global);
+  atomic_store(&self->state, (e << 1) | 1);
+}
+
+void epochExit(RAVL_Epoch *epoch) {
+  (void)epoch;
+  atomic_store(&self->state, 0);
+}
+
+void epochRetire(RAVL_Epoch *epoch, RAVL_Node *node) {
+  EpochThread *t = self;
+  unsigned long e = atomic_load(&epoch->global);
+
+  if (t == NULL) {  // not registered: hand the node to the domain
+    pthread_mutex_lock(&epoch->threads_lock);
+    epoch->orphans.epoch = e;
+    int full = limboPush(&epoch->orphans, node);
+    pthread_mutex_unlock(&epoch->threads_lock);
+    if (full != 0) {
+      waitAndFree(epoch, node, e);
+    }
+    return;
+  }
+
+  Limbo *l = &t->limbo[e % 3];
+  if (l->epoch != e) {  // the list holds nodes from epoch e - 3 or earlier
+    limboFree(epoch, l);
+    l->epoch = e;
+  }
+  // a reader that cannot record the node has to leak it: waiting for it to
+  // become safe would mean waiting for the reader itself
+  if (limboPush(l, node) != 0 && !(atomic_load(&t->state) & 1)) {
+    waitAndFree(epoch, node, e);
+  }
+
+  if (++t->retired >= EPOCH_BATCH) {
+    t->retired = 0;
+    unsigned long g = tryAdvance(epoch);
+    for (int b = 0; b < 3; b++) {
+      if (t->limbo[b].epoch + 2 <= g) {
+        limboFree(epoch, &t->limbo[b]);
+      }
+    }
+  }
+}
+
+RAVL_Allocator *epochAllocator(RAVL_Epoch *epoch) { return &epoch->allocator; }
+
+void epochDestroy(RAVL_Epoch *epoch) {
+  if (epoch == NULL) {
+    return;
+  }
+
+  EpochThread *t = epoch->threads;
+  while (t != NULL) {
+    EpochThread *next = t->next;
+    for (int b = 0; b < 3; b++) {
+      limboFree(epoch, &t->limbo[b]);
+      free(t->limbo[b].nodes);
+    }
+    if (self == t) {
+      self = NULL;
+    }
+    free(t);
+    t = next;
+  }
+  limboFree(epoch, &epoch->orphans);
+  free(epoch->orphans.nodes);
+  pthread_mutex_destroy(&epoch->threads_lock);
+  pthread_mutex_destroy(&epoch->backing_lock);
+  free(epoch);
+}
@@ -0,0 +1,72 @@
+/*
+ *  Header file for epoch-based reclamation of RAVL tree nodes.
+ *
+ *  When readers may be walking a tree while another thread deletes from it,
+ *  a deleted node cannot be freed right away: a reader may still hold a
+ *  pointer to it. An epoch domain defers those frees until every thread
+ *  that was inside a read section at the time has left it.
+ *
+ *  Every thread using the domain registers once. Readers bracket each
+ *  traversal with epochEnter()/epochExit(). Writers retire nodes instead of
+ *  freeing them; the easiest way is setAllocator(epochAllocator(epoch)),
+ *  which makes delete() and deleteTree() retire nodes on the calling thread.
+ *  Retired nodes go back to the domain's backing allocator in batches of
+ *  EPOCH_BATCH.
+ *
+ *  A thread may be registered with only one domain at a time.
+*/
+
+#include "RAVL_tree.h"
+
+#ifndef __RAVL_epoch_header
+#define __RAVL_epoch_header
+
+#define EPOCH_BATCH 256  // retired nodes per thread between reclaim attempts
+
+typedef struct ravl_epoch RAVL_Epoch;
+
+/* Returns a new epoch domain that takes nodes from, and returns retired
+ * nodes to, 'backing' (malloc() and free() if 'backing' is NULL). Calls to
+ * 'backing' are serialized by the domain, so it need not be thread-safe.
+ * Returns NULL if memory runs out.
+*/
+RAVL_Epoch* epochCreate(RAVL_Allocator* backing);
+
+/* Registers the calling thread with 'epoch'. Returns 0 on success, -1 if
+ * memory runs out.
+*/
+int epochRegister(RAVL_Epoch* epoch);
+
+/* Unregisters the calling thread from 'epoch'. Nodes it retired that are
+ * not yet safe to free are handed to the domain. Must not be called inside
+ * a read section.
+*/
+void epochUnregister(RAVL_Epoch* epoch);
+
+/* Starts a read section on the calling thread: no node retired from now on
+ * is freed before the matching epochExit().
+*/
+void epochEnter(RAVL_Epoch* epoch);
+
+/* Ends the calling thread's read section.
+*/
+void epochExit(RAVL_Epoch* epoch);
+
+/* Retires 'node', which must already be unreachable for new readers: it is
+ * returned to the backing allocator once no read section that might still
+ * see it is active. The calling thread must be registered.
+*/
+void epochRetire(RAVL_Epoch* epoch, RAVL_Node* node);
+
+/* Returns the allocator for setAllocator() that takes new nodes from the
+ * backing allocator and retires released nodes through 'epoch'.
+*/
+RAVL_Allocator* epochAllocator(RAVL_Epoch* epoch);
+
+/* Frees 'epoch', returning every retired node to the backing allocator. No
+ * thread may be in a read section, and all threads should have
+ * unregistered.
+*/
+void epochDestroy(RAVL_Epoch* epoch);
+
+#endif
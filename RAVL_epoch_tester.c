@@ -0,0 +1,160 @@
+/*
+ *  Use-after-free stress test for epoch-based reclamation.
+ *
+ *  Usage: RAVL_epoch_tester [readers [writers [swaps per writer]]]
+ *
+ *  Writers keep replacing the nodes in a table of shared slots and retire
+ *  the old ones; readers load the slots inside read sections and check the
+ *  nodes they see. The backing allocator poisons every node it gets back,
+ *  so a node freed while a reader could still see it shows up as a failed
+ *  check even without a memory checker. A second phase runs insert() and
+ *  delete() on random keys (see RAVL_TEST_SEED) of a tree with
+ *  setAllocator(epochAllocator(epoch)). Exits with status 1 on the first
+ *  failure.
+ *
+ *  Build: gcc -O2 RAVL_epoch_tester.c RAVL_epoch.c RAVL_tree.c -pthread
+ */
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <string.h>
+
+#include "RAVL_epoch.h"
+#include "RAVL_test.h"
+
+#define SLOTS 64
+#define POISON 0x5a  // byte written over released nodes
+
+RAVL_Epoch* epoch;
+RAVL_Node* slots[SLOTS];
+long swaps;
+int stop;
+long live_nodes;  // nodes the backing allocator has handed out
+
+void* takeNode(void* ctx);
+void releaseNode(void* ctx, void* node);
+void* readSlots(void* arg);
+void* swapSlots(void* arg);
+void churnTree(void);
+
+int main(int argc, char* argv[]) {
+  testSeed();
+  int readers = argc > 1 ? atoi(argv[1]) : 4;
+  int writers = argc > 2 ? atoi(argv[2]) : 2;
+  swaps = argc > 3 ? atol(argv[3]) : 200000;
+  if (readers < 1 || writers < 1) {
+    fprintf(stderr, "need at least one reader and one writer\n");
+    return 1;
+  }
+
+  RAVL_Allocator backing = {takeNode, releaseNode, NULL};
+  epoch = epochCreate(&backing);
+  CHECK(epoch != NULL);
+  setAllocator(epochAllocator(epoch));
+
+  pthread_t threads[readers + writers];
+  for (int i = 0; i < readers; i++) {
+    pthread_create(&threads[i], NULL, readSlots, NULL);
+  }
+  for (long i = 0; i < writers; i++) {
+    pthread_create(&threads[readers + i], NULL, swapSlots, (void*)i);
+  }
+  for (int i = 0; i < writers; i++) {
+    pthread_join(threads[readers + i], NULL);
+  }
+  __atomic_store_n(&stop, 1, __ATOMIC_RELAXED);
+  for (int i = 0; i < readers; i++) {
+    pthread_join(threads[i], NULL);
+  }
+
+  churnTree();
+
+  for (int i = 0; i < SLOTS; i++) {
+    if (slots[i] != NULL) {
+      epochRetire(epoch, slots[i]);
+    }
+  }
+  epochDestroy(epoch);
+  setAllocator(NULL);
+  CHECK(live_nodes == 0);
+  printf("ok\n");
+  return 0;
+}
+
+void* takeNode(void* ctx) {
+  (void)ctx;
+  live_nodes++;  // the domain serializes calls to the backing allocator
+  return malloc(sizeof(RAVL_Node));
+}
+
+void releaseNode(void* ctx, void* node) {
+  (void)ctx;
+  live_nodes--;
+  memset(node, POISON, sizeof(RAVL_Node));
+  free(node);
+}
+
+void* readSlots(void* arg) {
+  (void)arg;
+  epochRegister(epoch);
+  while (!__atomic_load_n(&stop, __ATOMIC_RELAXED)) {
+    epochEnter(epoch);
+    for (int i = 0; i < SLOTS; i++) {
+      RAVL_Node* node = __atomic_load_n(&slots[i], __ATOMIC_ACQUIRE);
+      if (node != NULL) {
+        // the writer stored the slot's index as the value
+        CHECK(node->size == 1 && node->height == 1);
+        CHECK((long)node->value == i);
+      }
+    }
+    epochExit(epoch);
+  }
+  epochUnregister(epoch);
+  return NULL;
+}
+
+void* swapSlots(void* arg) {
+  long w = (long)arg;
+
+  epochRegister(epoch);
+  for (long k = 0; k < swaps; k++) {
+    int i = (int)((k * 31 + w) % SLOTS);
+    RAVL_Node* node = insert(NULL, (int)k, (void*)(long)i);
+    CHECK(node != NULL);
+    RAVL_Node* old = __atomic_exchange_n(&slots[i], node, __ATOMIC_ACQ_REL);
+    if (old != NULL) {
+      epochRetire(epoch, old);
+    }
+  }
+  epochUnregister(epoch);
+  return NULL;
+}
+
+/* Runs inserts and deletes, which retire nodes through the installed
+ * allocator, and checks the tree afterwards.
+ */
+void churnTree(void) {
+  RAVL_Node* root = NULL;
+  char in[5000] = {0};
+  int n = 0;
+  unsigned seed = test_seed;
+
+  epochRegister(epoch);
+  for (int i = 0; i < 100000; i++) {
+    int key = testRandom(&seed) % 5000;
+    n += !in[key];
+    in[key] = 1;
+    root = insert(root, key, NULL);
+    if (i % 3 == 0) {
+      key = testRandom(&seed) % 5000;
+      n -= in[key];
+      in[key] = 0;
+      root = delete(root, key);
+    }
+  }
+  CHECK((root == NULL ? 0 : root->size) == n);
+  for (int key = 0; key < 5000; key++) {
+    CHECK((search(root, key) != NULL) == in[key]);
+  }
+  deleteTree(root);
+  epochUnregister(epoch);
+}
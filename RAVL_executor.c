@@ -0,0 +1,260 @@
+/*
+ *  A batching query executor for RAVL trees.
+ *
+ *  Callers are spread over the workers round-robin. Each worker has its own
+ *  queue, so callers only contend with the callers of the same worker, and
+ *  wakes all of a batch's callers with one broadcast.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+
+#include "RAVL_executor.h"
+
+#define Q_RANK 0
+#define Q_FIND_RANK 1
+
+struct exec_worker {
+  pthread_t thread;
+  pthread_mutex_t lock;     // guards the queue and the futures' 'done'
+  pthread_cond_t queued;    // signalled when the queue becomes non-empty
+  pthread_cond_t answered;  // broadcast after every batch
+  RAVL_Future* head;        // queued queries, oldest first
+  RAVL_Future* tail;
+  int count;                // number of queued queries
+  int stop;
+  RAVL_Executor* executor;
+  RAVL_Future** batch;      // the batch being answered
+  int* args;                // its keys or ranks, grouped by query type
+  int* ranks;
+  RAVL_Node** nodes;
+};
+
+struct ravl_executor {
+  ExecWorker* workers;
+  int n;
+  int batch;                 // largest batch
+  int delay;                 // microseconds to wait for a batch to fill
+  atomic_uint next;          // worker for the next query
+  pthread_rwlock_t tree_lock;
+  RAVL_Node* root;
+};
+
+/*************************************************************************
+ ** Helper functions
+ *************************************************************************/
+
+/* Answers the 'n' queries in 'w->batch'. */
+void answerBatch(ExecWorker *w, int n) {
+  RAVL_Executor *ex = w->executor;
+  int nr = 0, nf = 0;
+
+  for (int i = 0; i < n; i++) {  // rank queries first, find-rank queries last
+    if (w->batch[i]->op == Q_RANK) {
+      w->args[nr++] = w->batch[i]->arg;
+    } else {
+      w->args[n - ++nf] = w->batch[i]->arg;
+    }
+  }
+
+  pthread_rwlock_rdlock(&ex->tree_lock);
+  rankBatch(ex->root, w->args, nr, w->ranks);
+  findRankBatch(ex->root, w->args + nr, nf, w->nodes + nr);
+  pthread_rwlock_unlock(&ex->tree_lock);
+
+  nr = 0;
+  nf = 0;
+  for (int i = 0; i < n; i++) {
+    if (w->batch[i]->op == Q_RANK) {
+      w->batch[i]->rank = w->ranks[nr++];
+    } else {
+      w->batch[i]->node = w->nodes[n - ++nf];
+    }
+  }
+}
+
+void *workerLoop(void *arg) {
+  ExecWorker *w = (ExecWorker *)arg;
+  RAVL_Executor *ex = w->executor;
+
+  pthread_mutex_lock(&w->lock);
+  while (1) {
+    while (w->count == 0 && !w->stop) {
+      pthread_cond_wait(&w->queued, &w->lock);
+    }
+    if (w->count == 0) {
+      break;  // stopped and drained
+    }
+
+    if (w->count < ex->batch && !w->stop && ex->delay > 0) {
+      struct timespec until;
+      clock_gettime(CLOCK_REALTIME, &until);
+      until.tv_nsec += ex->delay * 1000L;
+      until.tv_sec += until.tv_nsec / 1000000000L;
+      until.tv_nsec %= 1000000000L;
+      while (w->count < ex->batch && !w->stop &&
+             pthread_cond_timedwait(&w->queued, &w->lock, &until) != ETIMEDOUT) {
+      }
+    }
+
+    int n = 0;
+    while (w->head != NULL && n < ex->batch) {
+      w->batch[n++] = w->head;
+      w->head = w->head->next;
+    }
+    if (w->head == NULL) {
+      w->tail = NULL;
+    }
+    w->count -= n;
+    pthread_mutex_unlock(&w->lock);
+
+    answerBatch(w, n);
+
+    pthread_mutex_lock(&w->lock);
+    for (int i = 0; i < n; i++) {
+      w->batch[i]->done = 1;
+    }
+    pthread_cond_broadcast(&w->answered);
+  }
+  pthread_mutex_unlock(&w->lock);
+  return NULL;
+}
+
+void submitQuery(RAVL_Executor *ex, int op, int arg, RAVL_Future *f) {
+  ExecWorker *w = &ex->workers[atomic_fetch_add(&ex->next, 1) % ex->n];
+
+  f->op = op;
+  f->arg = arg;
+  f->done = 0;
+  f->worker = w;
+  f->next = NULL;
+
+  pthread_mutex_lock(&w->lock);
+  if (w->tail == NULL) {
+    w->head = f;
+  } else {
+    w->tail->next = f;
+  }
+  w->tail = f;
+  w->count++;
+  if (w->count == 1 || w->count >= ex->batch) {
+    pthread_cond_signal(&w->queued);
+  }
+  pthread_mutex_unlock(&w->lock);
+}
+
+/* Stops the first 'n' workers of 'ex' and frees everything. */
+void shutdownWorkers(RAVL_Executor *ex, int n) {
+  for (int i = 0; i < n; i++) {
+    ExecWorker *w = &ex->workers[i];
+    pthread_mutex_lock(&w->lock);
+    w->stop = 1;
+    pthread_cond_signal(&w->queued);
+    pthread_mutex_unlock(&w->lock);
+    pthread_join(w->thread, NULL);
+  }
+  for (int i = 0; i < ex->n; i++) {
+    ExecWorker *w = &ex->workers[i];
+    pthread_mutex_destroy(&w->lock);
+    pthread_cond_destroy(&w->queued);
+    pthread_cond_destroy(&w->answered);
+    free(w->batch);
+    free(w->args);
+    free(w->ranks);
+    free(w->nodes);
+  }
+  pthread_rwlock_destroy(&ex->tree_lock);
+  free(ex->workers);
+  free(ex);
+}
+
+/*************************************************************************
+ ** Executor functions
+ *************************************************************************/
+
+RAVL_Executor *executorCreate(RAVL_Node *node, int workers, int batch, int delay) {
+  RAVL_Executor *ex = (RAVL_Executor *)malloc(sizeof(RAVL_Executor));
+  if (ex == NULL) {
+    return NULL;
+  }
+
+  ex->n = workers > 0 ? workers : 1;
+  ex->batch = batch > 0 ? batch : BATCH_WIDTH;
+  ex->delay = delay;
+  ex->root = node;
+  atomic_init(&ex->next, 0);
+  // writer-preferring, so executorSetRoot() gets in between back-to-back
+  // batches instead of waiting for a moment with no batch at all
+  pthread_rwlockattr_t attr;
+  pthread_rwlockattr_init(&attr);
+  pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+  pthread_rwlock_init(&ex->tree_lock, &attr);
+  pthread_rwlockattr_destroy(&attr);
+  ex->workers = (ExecWorker *)calloc(ex->n, sizeof(ExecWorker));
+  if (ex->workers == NULL) {
+    pthread_rwlock_destroy(&ex->tree_lock);
+    free(ex);
+    return NULL;
+  }
+
+  int ok = 1;
+  for (int i = 0; i < ex->n; i++) {
+    ExecWorker *w = &ex->workers[i];
+    pthread_mutex_init(&w->lock, NULL);
+    pthread_cond_init(&w->queued, NULL);
+    pthread_cond_init(&w->answered, NULL);
+    w->executor = ex;
+    w->batch = (RAVL_Future **)malloc(ex->batch * sizeof(RAVL_Future *));
+    w->args = (int *)malloc(ex->batch * sizeof(int));
+    w->ranks = (int *)malloc(ex->batch * sizeof(int));
+    w->nodes = (RAVL_Node **)malloc(ex->batch * sizeof(RAVL_Node *));
+    if (w->batch == NULL || w->args == NULL || w->ranks == NULL || w->nodes == NULL) {
+      ok = 0;
+    }
+  }
+
+  int started = 0;
+  while (ok && started < ex->n &&
+         pthread_create(&ex->workers[started].thread, NULL, workerLoop,
+                        &ex->workers[started]) == 0) {
+    started++;
+  }
+  if (started < ex->n) {
+    shutdownWorkers(ex, started);
+    return NULL;
+  }
+  return ex;
+}
+
+void executorRank(RAVL_Executor *executor, int key, RAVL_Future *future) {
+  submitQuery(executor, Q_RANK, key, future);
+}
+
+void executorFindRank(RAVL_Executor *executor, int rank, RAVL_Future *future) {
+  submitQuery(executor, Q_FIND_RANK, rank, future);
+}
+
+void futureWait(RAVL_Future *future) {
+  ExecWorker *w = future->worker;
+
+  pthread_mutex_lock(&w->lock);
+  while (!future->done) {
+    pthread_cond_wait(&w->answered, &w->lock);
+  }
+  pthread_mutex_unlock(&w->lock);
+}
+
+void executorSetRoot(RAVL_Executor *executor, RAVL_Node *node) {
+  pthread_rwlock_wrlock(&executor->tree_lock);
+  executor->root = node;
+  pthread_rwlock_unlock(&executor->tree_lock);
+}
+
+void executorDestroy(RAVL_Executor *executor) {
+  if (executor != NULL) {
+    shutdownWorkers(executor, executor->n);
+  }
+}
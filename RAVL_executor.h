@@ -0,0 +1,69 @@
+/*
+ *  Header file for a batching query executor for RAVL trees.
+ *
+ *  Many threads issuing single rank() or findRank() calls each pay the
+ *  full cache-miss latency of their walk. The executor instead queues the
+ *  calls on its worker threads, lets each worker gather a micro-batch (up
+ *  to 'batch' queries, waiting at most 'delay' microseconds for it to fill),
+ *  and answers the batch with rankBatch()/findRankBatch(), whose interleaved
+ *  walks overlap those misses. Callers get their answers through futures.
+ *
+ *  The executor only reads the tree. Do not change the tree while the
+ *  executor may be reading it; to publish a new version, build or update a
+ *  separate tree and switch to it with executorSetRoot().
+*/
+
+#include "RAVL_tree.h"
+
+#ifndef __RAVL_executor_header
+#define __RAVL_executor_header
+
+typedef struct ravl_executor RAVL_Executor;
+typedef struct exec_worker ExecWorker;
+
+/* A pending query. The caller owns the memory (e.g. on its stack) and must
+ * keep it alive until futureWait() returns.
+*/
+typedef struct ravl_future {
+  int op;                    // internal: which query
+  int arg;                   // internal: the key or rank asked for
+  int done;                  // internal: set once the answer is in
+  ExecWorker* worker;        // internal: the worker answering it
+  struct ravl_future* next;  // internal: the worker's queue
+  int rank;                  // answer to executorRank()
+  RAVL_Node* node;           // answer to executorFindRank()
+} RAVL_Future;
+
+/* Returns a new executor over the RAVL tree rooted at 'node', with
+ * 'workers' worker threads gathering up to 'batch' queries each and waiting
+ * at most 'delay' microseconds for a batch to fill. Returns NULL if it
+ * could not be started.
+*/
+RAVL_Executor* executorCreate(RAVL_Node* node, int workers, int batch, int delay);
+
+/* Queues a query for the rank of 'key'; the answer (or NOTIN) is stored in
+ * 'future->rank'.
+*/
+void executorRank(RAVL_Executor* executor, int key, RAVL_Future* future);
+
+/* Queues a query for the node with rank 'rank'; the answer (or NULL) is
+ * stored in 'future->node'.
+*/
+void executorFindRank(RAVL_Executor* executor, int rank, RAVL_Future* future);
+
+/* Waits until the query of 'future' has been answered.
+*/
+void futureWait(RAVL_Future* future);
+
+/* Makes the executor answer queries from the RAVL tree rooted at 'node'
+ * from now on. Returns once no batch reads the old tree, which the caller
+ * may then change or free.
+*/
+void executorSetRoot(RAVL_Executor* executor, RAVL_Node* node);
+
+/* Answers all queued queries, stops the workers and frees 'executor'. The
+ * tree is not freed.
+*/
+void executorDestroy(RAVL_Executor* executor);
+
+#endif
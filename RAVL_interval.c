@@ -0,0 +1,219 @@
+/*
+ *  Interval trees built on RAVL trees.
+ */
+
+#include <stddef.h>
+
+#include "RAVL_interval.h"
+
+/*************************************************************************
+ ** Helper functions
+ *************************************************************************/
+
+// where nodes come from; NULL means malloc() and free()
+static RAVL_Allocator *allocator = NULL;
+
+_Static_assert(offsetof(RAVL_INode, key) == offsetof(RAVL_Node, key) &&
+                   offsetof(RAVL_INode, value) == offsetof(RAVL_Node, value) &&
+                   offsetof(RAVL_INode, height) == offsetof(RAVL_Node, height) &&
+                   offsetof(RAVL_INode, size) == offsetof(RAVL_Node, size) &&
+                   offsetof(RAVL_INode, left) == offsetof(RAVL_Node, left) &&
+                   offsetof(RAVL_INode, right) == offsetof(RAVL_Node, right),
+               "RAVL_INode must start with the fields of a RAVL_Node");
+
+int ivSize(RAVL_INode *node) { return node == NULL ? 0 : node->size; }
+
+/* Updates the largest end of 'node' from its children, for
+ * rebalanceAugmented().
+ */
+void ivAugment(RAVL_Node *base) {
+  RAVL_INode *node = (RAVL_INode *)base;
+
+  node->max_end = node->end;
+  if (node->left != NULL && node->left->max_end > node->max_end) {
+    node->max_end = node->left->max_end;
+  }
+  if (node->right != NULL && node->right->max_end > node->max_end) {
+    node->max_end = node->right->max_end;
+  }
+}
+
+RAVL_INode *ivRebalance(RAVL_INode *node) {
+  return (RAVL_INode *)rebalanceAugmented(&node->node, ivAugment);
+}
+
+/* Creates and returns a leaf holding the interval [start, end] with value
+ * 'value', taking its memory from the installed allocator. Returns NULL if
+ * memory runs out.
+ */
+RAVL_INode *ivCreateNode(int start, int end, void *value) {
+  RAVL_INode *node;
+  if (allocator == NULL) {
+    node = (RAVL_INode *)malloc(sizeof(RAVL_INode));
+  } else {
+    node = (RAVL_INode *)allocator->alloc(allocator->ctx);
+  }
+  if (node == NULL) {
+    return NULL;
+  }
+
+  node->key = start;
+  node->end = end;
+  node->value = value;
+  node->left = NULL;
+  node->right = NULL;
+  return ivRebalance(node);
+}
+
+/* Returns 'node' to the allocator ivCreateNode() got it from. */
+void ivFreeNode(RAVL_INode *node) {
+  if (allocator == NULL) {
+    free(node);
+  } else {
+    allocator->release(allocator->ctx, node);
+  }
+}
+
+/* Detaches the node with the smallest start from the tree rooted at 'node',
+ * storing it in 'min', and returns the root of the rest.
+ */
+RAVL_INode *ivDetachMin(RAVL_INode *node, RAVL_INode **min) {
+  if (node->left == NULL) {
+    *min = node;
+    return node->right;
+  }
+  node->left = ivDetachMin(node->left, min);
+  return ivRebalance(node);
+}
+
+/* Visits the intervals overlapping [lo, hi] in the tree rooted at 'node' in
+ * increasing order of start, storing them in 'out' (if it is not NULL)
+ * from index 'n' on while there is room for them. Returns the new count.
+ */
+int ivCollect(RAVL_INode *node, int lo, int hi, RAVL_INode **out, int max, int n) {
+  if (node == NULL || node->max_end < lo || (out != NULL && n >= max)) {
+    return n;
+  }
+
+  n = ivCollect(node->left, lo, hi, out, max, n);
+  if (node->key > hi) {
+    return n;  // this interval and everything to its right start too late
+  }
+  if (node->end >= lo && (out == NULL || n < max)) {
+    if (out != NULL) {
+      out[n] = node;
+    }
+    n++;
+  }
+  return ivCollect(node->right, lo, hi, out, max, n);
+}
+
+/*************************************************************************
+ ** Interval tree functions
+ *************************************************************************/
+
+void intervalSetAllocator(RAVL_Allocator *new_allocator) { allocator = new_allocator; }
+
+RAVL_INode *intervalInsert(RAVL_INode *node, int start, int end, void *value) {
+  if (node == NULL) {
+    return ivCreateNode(start, end, value);
+  }
+
+  if (start < node->key) {
+    node->left = intervalInsert(node->left, start, end, value);
+  } else if (start > node->key) {
+    node->right = intervalInsert(node->right, start, end, value);
+  } else {
+    node->end = end;
+    node->value = value;
+  }
+  return ivRebalance(node);
+}
+
+RAVL_INode *intervalDelete(RAVL_INode *node, int start) {
+  if (node == NULL) {
+    return NULL;
+  }
+
+  if (start < node->key) {
+    node->left = intervalDelete(node->left, start);
+  } else if (start > node->key) {
+    node->right = intervalDelete(node->right, start);
+  } else {
+    RAVL_INode *rest;
+    if (node->left == NULL) {
+      rest = node->right;
+    } else if (node->right == NULL) {
+      rest = node->left;
+    } else {  // the successor takes this node's place
+      RAVL_INode *min;
+      RAVL_INode *right = ivDetachMin(node->right, &min);
+      min->left = node->left;
+      min->right = right;
+      rest = ivRebalance(min);
+    }
+    ivFreeNode(node);
+    return rest;
+  }
+  return ivRebalance(node);
+}
+
+RAVL_INode *intervalSearch(RAVL_INode *node, int start) {
+  while (node != NULL && node->key != start) {
+    node = start < node->key ? node->left : node->right;
+  }
+  return node;
+}
+
+int intervalRank(RAVL_INode *node, int start) {
+  int seen = 0;  // starts known to be smaller than the current subtree
+
+  while (node != NULL && node->key != start) {
+    if (start > node->key) {
+      seen += ivSize(node->left) + 1;
+      node = node->right;
+    } else {
+      node = node->left;
+    }
+  }
+  return node == NULL ? NOTIN : seen + ivSize(node->left) + 1;
+}
+
+RAVL_INode *intervalFindRank(RAVL_INode *node, int rank) {
+  while (node != NULL) {
+    int r = ivSize(node->left) + 1;
+    if (r == rank) {
+      return node;
+    } else if (rank < r) {
+      node = node->left;
+    } else {
+      rank -= r;
+      node = node->right;
+    }
+  }
+  return NULL;
+}
+
+int intervalOverlapping(RAVL_INode *node, int lo, int hi, RAVL_INode **out, int max) {
+  if (max <= 0) {
+    return 0;
+  }
+  return ivCollect(node, lo, hi, out, max, 0);
+}
+
+int intervalStabbing(RAVL_INode *node, int t, RAVL_INode **out, int max) {
+  return intervalOverlapping(node, t, t, out, max);
+}
+
+int intervalCountOverlapping(RAVL_INode *node, int lo, int hi) {
+  return ivCollect(node, lo, hi, NULL, 0, 0);
+}
+
+void intervalDeleteTree(RAVL_INode *node) {
+  if (node == NULL) {
+    return;
+  }
+  intervalDeleteTree(node->left);
+  intervalDeleteTree(node->right);
+  ivFreeNode(node);
+}
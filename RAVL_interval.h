@@ -0,0 +1,93 @@
+/*
+ *  Header file for interval trees built on RAVL trees.
+ *
+ *  An interval tree is a RAVL tree keyed by the starts of closed intervals
+ *  [start, end], where every node also records the largest end in its
+ *  subtree. The balancing is the core tree's: rebalanceAugmented() keeps
+ *  that maximum up to date alongside the height and size, so overlap
+ *  queries can skip every subtree whose intervals all end too early, while
+ *  rank queries on the starts work as usual.
+ *
+ *  Nodes come from malloc() and free() unless intervalSetAllocator() says
+ *  otherwise.
+*/
+
+#include "RAVL_tree.h"
+
+#ifndef __RAVL_interval_header
+#define __RAVL_interval_header
+
+typedef struct ravl_inode {
+  union {
+    RAVL_Node node;             // the fields below, as the core tree sees them
+    struct {
+      int key;                  // start of this node's interval
+      int live;                 // kept by the core tree, unused here
+      void* value;              // value associated with this node's interval
+      int height;               // height of tree rooted at this node
+      int size;                 // size of tree rooted at this node
+      struct ravl_inode* left;  // this node's left child
+      struct ravl_inode* right; // this node's right child
+    };
+  };
+  int end;                      // end of this node's interval
+  int max_end;                  // largest end in the tree rooted at this node
+} RAVL_INode;
+
+/* Makes all interval trees take their nodes from 'allocator' (which must
+ * stay valid while in use) instead of malloc() and free(), as setAllocator()
+ * does for RAVL trees. Its alloc() must return sizeof(RAVL_INode) bytes,
+ * more than a RAVL_Node, so a pool from RAVL_pool.h does not qualify, nor
+ * does an epoch allocator (RAVL_epoch.h) unless its backing allocator
+ * does. Passing NULL restores malloc() and free().
+*/
+void intervalSetAllocator(RAVL_Allocator* allocator);
+
+/* Inserts the interval [start, end] with value 'value' into the interval
+ * tree rooted at 'node', and returns the root of the resulting tree.
+ * Starts are unique: if 'start' is already in the tree, that node's end
+ * and value are replaced. Requires start <= end. If memory runs out, the
+ * tree is unchanged.
+*/
+RAVL_INode* intervalInsert(RAVL_INode* node, int start, int end, void* value);
+
+/* Deletes the interval starting at 'start' from the interval tree rooted
+ * at 'node', and returns the root of the resulting tree.
+*/
+RAVL_INode* intervalDelete(RAVL_INode* node, int start);
+
+/* Returns the node of the interval tree rooted at 'node' whose interval
+ * starts at 'start', or NULL if there is none.
+*/
+RAVL_INode* intervalSearch(RAVL_INode* node, int start);
+
+/* Return the rank of the interval starting at 'start' among all intervals
+ * ordered by start (NOTIN if there is none), and the node with rank
+ * 'rank' (NULL if there is none), as rank() and findRank() do.
+*/
+int intervalRank(RAVL_INode* node, int start);
+RAVL_INode* intervalFindRank(RAVL_INode* node, int rank);
+
+/* Stores in 'out' the nodes of the interval tree rooted at 'node' whose
+ * intervals overlap [lo, hi] (start <= hi and end >= lo), in increasing
+ * order of start, stopping after 'max' of them. Returns the number
+ * stored. Visits O((k + 1) log n) nodes for k results.
+*/
+int intervalOverlapping(RAVL_INode* node, int lo, int hi, RAVL_INode** out, int max);
+
+/* Stores in 'out' the nodes whose intervals contain the point 't', like
+ * intervalOverlapping(node, t, t, out, max).
+*/
+int intervalStabbing(RAVL_INode* node, int t, RAVL_INode** out, int max);
+
+/* Returns the number of intervals in the tree rooted at 'node' that
+ * overlap [lo, hi], visiting the same nodes as intervalOverlapping() but
+ * storing nothing.
+*/
+int intervalCountOverlapping(RAVL_INode* node, int lo, int hi);
+
+/* Frees all memory allocated for the interval tree rooted at 'node'.
+*/
+void intervalDeleteTree(RAVL_INode* node);
+
+#endif
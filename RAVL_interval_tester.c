@@ -0,0 +1,170 @@
+/*
+ *  Checks interval trees against a brute-force scan.
+ *
+ *  Usage: RAVL_interval_tester [rounds]
+ *
+ *  Applies random inserts, updates and deletes of intervals to an interval
+ *  tree and to a plain table of intervals indexed by start, in 'rounds'
+ *  (default 400) batches. After each batch it checks the tree's shape (AVL
+ *  balance, heights, sizes, key order and every node's max_end, which the
+ *  core rotations keep through rebalanceAugmented()), and compares
+ *  intervalOverlapping(), intervalStabbing(), intervalCountOverlapping(),
+ *  intervalRank() and intervalFindRank() with a scan of the table. Nodes
+ *  come from a counting allocator installed with intervalSetAllocator(),
+ *  which poisons released nodes, and all must be back at the end. The
+ *  operations are seeded from RAVL_TEST_SEED. Exits with status 1 on the
+ *  first failure.
+ *
+ *  Build: gcc -O2 RAVL_interval_tester.c RAVL_interval.c RAVL_tree.c
+ */
+#define _GNU_SOURCE
+#include <string.h>
+
+#include "RAVL_interval.h"
+#include "RAVL_test.h"
+
+#define STARTS 2000       // starts drawn from -STARTS/2 .. STARTS/2 - 1
+#define BATCH 500         // operations per round
+#define QUERIES 200       // overlap and stabbing queries per round
+#define POISON 0x5a       // byte written over released nodes
+
+RAVL_INode* tree;
+char present[STARTS];     // present[s + STARTS/2]: an interval starts at s
+int ends[STARTS];         // its end
+long live_nodes;          // nodes the allocator has handed out
+
+void* takeNode(void* ctx);
+void releaseNode(void* ctx, void* node);
+void applyBatch(unsigned* seed);
+int checkShape(RAVL_INode* node, int lo, int hi);
+void checkQueries(unsigned* seed);
+
+int main(int argc, char* argv[]) {
+  unsigned seed = testSeed();
+  int rounds = argc > 1 ? atoi(argv[1]) : 400;
+
+  RAVL_Allocator counting = {takeNode, releaseNode, NULL};
+  intervalSetAllocator(&counting);
+
+  for (int round = 0; round < rounds; round++) {
+    applyBatch(&seed);
+    checkShape(tree, -STARTS, STARTS);
+    checkQueries(&seed);
+  }
+
+  intervalDeleteTree(tree);
+  intervalSetAllocator(NULL);
+  CHECK(live_nodes == 0);
+  printf("ok\n");
+  return 0;
+}
+
+void* takeNode(void* ctx) {
+  (void)ctx;
+  live_nodes++;
+  return malloc(sizeof(RAVL_INode));
+}
+
+void releaseNode(void* ctx, void* node) {
+  (void)ctx;
+  live_nodes--;
+  memset(node, POISON, sizeof(RAVL_INode));
+  free(node);
+}
+
+/* Inserts, updates and deletes random intervals. Most are short, some
+ * span a large part of the range, so that max_end matters.
+ */
+void applyBatch(unsigned* seed) {
+  for (int i = 0; i < BATCH; i++) {
+    unsigned r = testRandom(seed);
+    int start = (int)(r % STARTS) - STARTS / 2;
+    int slot = start + STARTS / 2;
+
+    if ((r >> 20) % 3 != 0) {
+      unsigned len = testRandom(seed);
+      int end = start + (int)(len % 16 == 0 ? len % STARTS : len % 20);
+      tree = intervalInsert(tree, start, end, (void*)(long)slot);
+      present[slot] = 1;
+      ends[slot] = end;
+    } else {
+      tree = intervalDelete(tree, start);
+      present[slot] = 0;
+    }
+  }
+}
+
+/* Checks the tree rooted at 'node', whose starts all lie strictly between
+ * 'lo' and 'hi', against the table, and returns its height.
+ */
+int checkShape(RAVL_INode* node, int lo, int hi) {
+  if (node == NULL) {
+    return 0;
+  }
+  CHECK(lo < node->key && node->key < hi);
+  int slot = node->key + STARTS / 2;
+  CHECK(present[slot] && node->end == ends[slot]);
+  CHECK((long)node->value == slot);
+
+  int left = checkShape(node->left, lo, node->key);
+  int right = checkShape(node->right, node->key, hi);
+  CHECK(left - right <= 1 && right - left <= 1);
+  CHECK(node->height == (left > right ? left : right) + 1);
+  CHECK(node->size == (node->left == NULL ? 0 : node->left->size) +
+                          (node->right == NULL ? 0 : node->right->size) + 1);
+
+  int max_end = node->end;
+  if (node->left != NULL && node->left->max_end > max_end) {
+    max_end = node->left->max_end;
+  }
+  if (node->right != NULL && node->right->max_end > max_end) {
+    max_end = node->right->max_end;
+  }
+  CHECK(node->max_end == max_end);
+  return node->height;
+}
+
+/* Compares random overlap and stabbing queries, including ones whose output
+ * is cut short by 'max', and every rank, with a scan of the table.
+ */
+void checkQueries(unsigned* seed) {
+  static RAVL_INode* out[STARTS];
+  static int expect[STARTS];
+
+  for (int q = 0; q < QUERIES; q++) {
+    unsigned r = testRandom(seed);
+    int lo = (int)(r % (STARTS + 40)) - STARTS / 2 - 20;
+    int hi = q % 2 == 0 ? lo : lo + (int)(testRandom(seed) % 100);
+    int n = 0;
+    for (int slot = 0; slot < STARTS; slot++) {
+      if (present[slot] && slot - STARTS / 2 <= hi && ends[slot] >= lo) {
+        expect[n++] = slot - STARTS / 2;
+      }
+    }
+
+    int max = q % 5 == 0 ? n / 2 : STARTS;
+    int got = lo == hi ? intervalStabbing(tree, lo, out, max)
+                       : intervalOverlapping(tree, lo, hi, out, max);
+    CHECK(got == (n < max ? n : max));
+    for (int i = 0; i < got; i++) {
+      CHECK(out[i]->key == expect[i]);
+    }
+    CHECK(intervalCountOverlapping(tree, lo, hi) == n);
+  }
+
+  int r = 0;
+  for (int slot = 0; slot < STARTS; slot++) {
+    int start = slot - STARTS / 2;
+    if (present[slot]) {
+      r++;
+      CHECK(intervalSearch(tree, start) != NULL);
+      CHECK(intervalRank(tree, start) == r);
+      CHECK(intervalFindRank(tree, r)->key == start);
+    } else {
+      CHECK(intervalSearch(tree, start) == NULL);
+      CHECK(intervalRank(tree, start) == NOTIN);
+    }
+  }
+  CHECK((tree == NULL ? 0 : tree->size) == r && live_nodes == r);
+  CHECK(intervalFindRank(tree, r + 1) == NULL);
+}
@@ -0,0 +1,96 @@
+/*
+ *  Interleaved lookups in RAVL trees.
+ */
+
+#include "RAVL_lookup.h"
+
+/*************************************************************************
+ ** Helper functions
+ *************************************************************************/
+
+/* Advances lookup 'l' by one node. Returns 1 if it has finished, 0 if it
+ * has prefetched its next node and should be resumed later.
+ */
+int lookupStep(RAVL_Lookup *l) {
+  RAVL_Node *at = l->at;
+  if (at == NULL) {
+    return 1;
+  }
+
+  int here = l->seen + (at->left == NULL ? 0 : at->left->size) + 1;
+  int hit, right;
+  if (l->op == LOOKUP_FIND_RANK) {
+    hit = (l->arg == here);
+    right = (l->arg > here);
+  } else {
+    hit = (l->arg == at->key);
+    right = (l->arg > at->key);
+  }
+
+  if (hit) {
+    l->node = at;
+    l->rank = here;
+    return 1;
+  }
+  if (right) {
+    l->seen = here;
+    l->at = at->right;
+  } else {
+    l->at = at->left;
+  }
+  if (l->at == NULL) {
+    return 1;
+  }
+  __builtin_prefetch(l->at);
+  return 0;
+}
+
+/* Starts lookup 'l' at the root 'node'. */
+void lookupStart(RAVL_Lookup *l, RAVL_Node *node) {
+  l->node = NULL;
+  l->rank = NOTIN;
+  l->at = node;
+  l->seen = 0;
+}
+
+/*************************************************************************
+ ** Lookup functions
+ *************************************************************************/
+
+void lookupInit(RAVL_Lookup *lookup, int op, int arg) {
+  lookup->op = op;
+  lookup->arg = arg;
+  lookupStart(lookup, NULL);
+}
+
+void lookupRun(RAVL_Node *node, RAVL_Lookup *lookups, int n, int inflight) {
+  RAVL_Lookup *slot[LOOKUP_MAX_INFLIGHT];
+  int next = 0;    // first lookup not yet started
+  int active = 0;  // slots in use
+
+  if (inflight <= 0) {
+    inflight = BATCH_WIDTH;
+  }
+  if (inflight > LOOKUP_MAX_INFLIGHT) {
+    inflight = LOOKUP_MAX_INFLIGHT;
+  }
+
+  while (active < inflight && next < n) {
+    lookupStart(&lookups[next], node);
+    slot[active++] = &lookups[next++];
+  }
+
+  while (active > 0) {
+    for (int i = 0; i < active; i++) {
+      if (!lookupStep(slot[i])) {
+        continue;
+      }
+      if (next < n) {  // reuse the slot for the next pending lookup
+        lookupStart(&lookups[next], node);
+        slot[i] = &lookups[next++];
+      } else {
+        slot[i--] = slot[--active];
+      }
+    }
+  }
+}
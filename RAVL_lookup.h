@@ -0,0 +1,47 @@
+/*
+ *  Header file for interleaved lookups in RAVL trees.
+ *
+ *  Each lookup is a small resumable state machine: one step visits one
+ *  node, prefetches the child it will visit next and yields. A round-robin
+ *  scheduler keeps a configurable number of lookups in flight and steps
+ *  them in turn, so while one lookup waits for its next node to arrive
+ *  from memory, the others make progress. When a lookup finishes, its slot
+ *  immediately starts the next pending one.
+ *
+ *  Unlike rankBatch(), lookups of different kinds can be mixed, and a long
+ *  lookup does not hold back the ones that started with it.
+*/
+
+#include "RAVL_tree.h"
+
+#ifndef __RAVL_lookup_header
+#define __RAVL_lookup_header
+
+#define LOOKUP_SEARCH 0
+#define LOOKUP_RANK 1
+#define LOOKUP_FIND_RANK 2
+
+#define LOOKUP_MAX_INFLIGHT 64
+
+typedef struct ravl_lookup {
+  int op;            // LOOKUP_SEARCH, LOOKUP_RANK or LOOKUP_FIND_RANK
+  int arg;           // the key, or the rank for LOOKUP_FIND_RANK
+  RAVL_Node* node;   // result: the node found, or NULL
+  int rank;          // result: its rank, or NOTIN
+  RAVL_Node* at;     // internal: the node to visit next
+  int seen;          // internal: keys known to be smaller than 'at'
+} RAVL_Lookup;
+
+/* Sets up lookup 'lookup' as a query of kind 'op' for 'arg'.
+*/
+void lookupInit(RAVL_Lookup* lookup, int op, int arg);
+
+/* Runs the 'n' lookups 'lookups' against the RAVL tree rooted at 'node',
+ * keeping up to 'inflight' of them in progress at a time (BATCH_WIDTH if
+ * 'inflight' is not positive, at most LOOKUP_MAX_INFLIGHT). Every lookup
+ * ends with 'node' set to the node it found (or NULL) and 'rank' set to
+ * that node's rank (or NOTIN), as search(), rank() and findRank() would.
+*/
+void lookupRun(RAVL_Node* node, RAVL_Lookup* lookups, int n, int inflight);
+
+#endif
@@ -0,0 +1,222 @@
+/*
+ *  Parallel bulk operations on RAVL trees.
+ *
+ *  Work is split recursively: each level hands one half to a new thread
+ *  (while threads remain and the half is at least PARALLEL_GRAIN) and does
+ *  the other half itself.
+ */
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <string.h>
+
+#include "RAVL_parallel.h"
+
+typedef struct sort_task {
+  RAVL_Op* ops;
+  RAVL_Op* tmp;   // scratch space for the same range
+  int n;
+  int threads;
+} SortTask;
+
+typedef struct apply_task {
+  RAVL_Node* node;
+  RAVL_Op* ops;   // sorted, one operation per key
+  int n;
+  int threads;
+  RAVL_Node* result;
+} ApplyTask;
+
+typedef struct export_task {
+  RAVL_Node* node;
+  int r1;
+  int r2;
+  int* keys;      // where rank r1 goes
+  void** values;  // where rank r1's value goes, or NULL
+} ExportTask;
+
+/*************************************************************************
+ ** Helper functions
+ *************************************************************************/
+
+/* Stably sorts 'task->ops' by key. */
+void *sortOps(void *arg) {
+  SortTask *task = (SortTask *)arg;
+  int n = task->n;
+  if (n < 2) {
+    return NULL;
+  }
+
+  int half = n / 2;
+  SortTask lo = {task->ops, task->tmp, half, task->threads / 2};
+  SortTask hi = {task->ops + half, task->tmp + half, n - half, task->threads - task->threads / 2};
+  pthread_t thread;
+  int spawned = task->threads > 1 && half >= PARALLEL_GRAIN &&
+                pthread_create(&thread, NULL, sortOps, &lo) == 0;
+  if (!spawned) {
+    sortOps(&lo);
+  }
+  sortOps(&hi);
+  if (spawned) {
+    pthread_join(thread, NULL);
+  }
+
+  int i = 0, j = half, k = 0;
+  while (i < half && j < n) {  // ties go to the earlier operation
+    task->tmp[k++] = task->ops[j].key < task->ops[i].key ? task->ops[j++] : task->ops[i++];
+  }
+  while (i < half) {
+    task->tmp[k++] = task->ops[i++];
+  }
+  while (j < n) {
+    task->tmp[k++] = task->ops[j++];
+  }
+  memcpy(task->ops, task->tmp, n * sizeof(RAVL_Op));
+  return NULL;
+}
+
+/* Applies 'task->ops' to 'task->node', storing the new root in
+ * 'task->result'.
+ */
+void *applyOps(void *arg) {
+  ApplyTask *task = (ApplyTask *)arg;
+  if (task->n == 0) {
+    task->result = task->node;
+    return NULL;
+  }
+
+  int mid = task->n / 2;
+  RAVL_Op *pivot = &task->ops[mid];
+  ApplyTask lo = {NULL, task->ops, mid, task->threads / 2, NULL};
+  ApplyTask hi = {NULL, pivot + 1, task->n - mid - 1, task->threads - task->threads / 2, NULL};
+  RAVL_Node *found = split(task->node, pivot->key, &lo.node, &hi.node);
+
+  pthread_t thread;
+  int spawned = task->threads > 1 && mid >= PARALLEL_GRAIN &&
+                pthread_create(&thread, NULL, applyOps, &lo) == 0;
+  if (!spawned) {
+    applyOps(&lo);
+  }
+  applyOps(&hi);
+  if (spawned) {
+    pthread_join(thread, NULL);
+  }
+
+  if (pivot->op == OP_INSERT) {
+    if (found != NULL) {
+      found->value = pivot->value;
+    } else {
+      found = insert(NULL, pivot->key, pivot->value);
+    }
+  } else if (found != NULL) {
+    deleteTree(found);  // detached, so this frees just the one node
+    found = NULL;
+  }
+
+  if (found != NULL) {
+    task->result = join(lo.result, found, hi.result);
+  } else {
+    task->result = join2(lo.result, hi.result);
+  }
+  return NULL;
+}
+
+void *exportPart(void *arg) {
+  ExportTask *task = (ExportTask *)arg;
+  exportRankRange(task->node, task->r1, task->r2, task->keys, task->values);
+  return NULL;
+}
+
+/*************************************************************************
+ ** Parallel functions
+ *************************************************************************/
+
+RAVL_Node *applyBatch(RAVL_Node *node, RAVL_Op *ops, int n, int threads) {
+  if (n <= 0) {
+    return node;
+  }
+
+  RAVL_Op *tmp = (RAVL_Op *)malloc(n * sizeof(RAVL_Op));
+  if (tmp == NULL) {  // no room to sort: apply the operations in order
+    for (int i = 0; i < n; i++) {
+      if (ops[i].op == OP_INSERT) {
+        node = insert(node, ops[i].key, ops[i].value);
+      } else {
+        node = delete(node, ops[i].key);
+      }
+    }
+    return node;
+  }
+
+  SortTask sort = {ops, tmp, n, threads};
+  sortOps(&sort);
+  free(tmp);
+
+  int m = 0;  // keep only the last operation on each key
+  for (int i = 0; i < n; i++) {
+    if (i + 1 < n && ops[i + 1].key == ops[i].key) {
+      continue;
+    }
+    ops[m++] = ops[i];
+  }
+
+  ApplyTask apply = {node, ops, m, threads, NULL};
+  applyOps(&apply);
+  return apply.result;
+}
+
+int exportRankRangeParallel(RAVL_Node *node, int r1, int r2, int *keys, void **values,
+                            int threads) {
+  int n = node == NULL ? 0 : node->size;
+  if (r1 < 1) {
+    r1 = 1;
+  }
+  if (r2 > n) {
+    r2 = n;
+  }
+  if (r1 > r2) {
+    return 0;
+  }
+
+  int count = r2 - r1 + 1;
+  int parts = count / PARALLEL_GRAIN;
+  if (parts > threads) {
+    parts = threads;
+  }
+  if (parts <= 1) {
+    return exportRankRange(node, r1, r2, keys, values);
+  }
+
+  ExportTask *tasks = (ExportTask *)malloc(parts * sizeof(ExportTask));
+  pthread_t *thread = (pthread_t *)malloc(parts * sizeof(pthread_t));
+  char *spawned = (char *)calloc(parts, 1);
+  if (tasks == NULL || thread == NULL || spawned == NULL) {
+    free(tasks);
+    free(thread);
+    free(spawned);
+    return exportRankRange(node, r1, r2, keys, values);
+  }
+
+  for (int i = 0; i < parts; i++) {
+    int from = (int)((long)count * i / parts);
+    int to = (int)((long)count * (i + 1) / parts);
+    ExportTask part = {node, r1 + from, r1 + to - 1, keys + from,
+                       values == NULL ? NULL : values + from};
+    tasks[i] = part;
+    // this thread copies the last part itself
+    spawned[i] = i + 1 < parts && pthread_create(&thread[i], NULL, exportPart, &tasks[i]) == 0;
+    if (!spawned[i]) {
+      exportPart(&tasks[i]);
+    }
+  }
+  for (int i = 0; i < parts; i++) {
+    if (spawned[i]) {
+      pthread_join(thread[i], NULL);
+    }
+  }
+
+  free(tasks);
+  free(thread);
+  free(spawned);
+  return count;
+}
@@ -0,0 +1,47 @@
+/*
+ *  Header file for parallel bulk operations on RAVL trees.
+ *
+ *  These functions spread their work over several threads. Trees they
+ *  build or change take nodes from the current allocator (see
+ *  setAllocator()) on all of those threads, so it must be thread-safe:
+ *  malloc() and epoch domains are, a bare node pool is not.
+*/
+
+#include "RAVL_tree.h"
+
+#ifndef __RAVL_parallel_header
+#define __RAVL_parallel_header
+
+#define OP_INSERT 0
+#define OP_DELETE 1
+
+#define PARALLEL_GRAIN 4096  // smallest amount of work handed to a thread
+
+typedef struct ravl_op {
+  int op;       // OP_INSERT or OP_DELETE
+  int key;
+  void* value;  // the value to insert (unused for OP_DELETE)
+} RAVL_Op;
+
+/* Applies the 'n' operations 'ops' to the RAVL tree rooted at 'node' using
+ * up to 'threads' threads, and returns the root of the resulting tree. The
+ * result is the same as applying them one by one with insert() and
+ * delete(), in array order: of several operations on one key, the last one
+ * wins.
+ *
+ * Sorts the batch, splits the tree at the batch's keys, and joins the
+ * pieces back together, so a batch of m operations on a tree of n keys
+ * takes O(m log(n/m + 1)) work. 'ops' is reordered. An insert that runs out
+ * of memory is dropped.
+*/
+RAVL_Node* applyBatch(RAVL_Node* node, RAVL_Op* ops, int n, int threads);
+
+/* Does what exportRankRange() does, splitting the rank interval into up to
+ * 'threads' equal parts that are located (with an O(log n) walk each) and
+ * copied concurrently. Parts are at least PARALLEL_GRAIN ranks long. Only
+ * reads the tree.
+*/
+int exportRankRangeParallel(RAVL_Node* node, int r1, int r2, int* keys, void** values,
+                            int threads);
+
+#endif
@@ -0,0 +1,174 @@
+/*
+ *  A node pool for RAVL trees.
+ *
+ *  Nodes are carved out of chunks in address order; released nodes are
+ *  chained through their 'left' pointers on a free list and handed out again
+ *  before any new chunk is touched.
+ */
+
+#define _GNU_SOURCE
+#include <sched.h>
+
+#ifdef RAVL_USE_NUMA
+#include <numa.h>
+#endif
+
+#include "RAVL_pool.h"
+
+typedef struct pool_chunk {
+  struct pool_chunk* next;  // previously allocated chunk
+  size_t bytes;             // size of this chunk, header included
+  RAVL_Node nodes[];
+} PoolChunk;
+
+struct ravl_pool {
+  PoolChunk* chunks;        // most recent chunk first
+  int used;                 // nodes handed out from the most recent chunk
+  int chunk;                // nodes per chunk
+  int placement;            // POOL_ANY, POOL_INTERLEAVED or a NUMA node
+  RAVL_Node* free_list;     // released nodes
+  RAVL_Allocator allocator;
+};
+
+/*************************************************************************
+ ** Helper functions
+ *************************************************************************/
+
+/* Returns 'bytes' bytes of memory placed according to 'placement'. */
+void *chunkAlloc(size_t bytes, int placement) {
+#ifdef RAVL_USE_NUMA
+  if (placement != POOL_ANY && numa_available() >= 0) {
+    if (placement == POOL_INTERLEAVED) {
+      return numa_alloc_interleaved(bytes);
+    }
+    return numa_alloc_onnode(bytes, placement);
+  }
+#endif
+  (void)placement;
+  return malloc(bytes);
+}
+
+void chunkFree(PoolChunk *c, int placement) {
+#ifdef RAVL_USE_NUMA
+  if (placement != POOL_ANY && numa_available() >= 0) {
+    numa_free(c, c->bytes);
+    return;
+  }
+#endif
+  (void)placement;
+  free(c);
+}
+
+void *poolAlloc(void *ctx) {
+  RAVL_Pool *pool = (RAVL_Pool *)ctx;
+
+  if (pool->free_list != NULL) {
+    RAVL_Node *node = pool->free_list;
+    pool->free_list = node->left;
+    return node;
+  }
+
+  if (pool->chunks == NULL || pool->used == pool->chunk) {
+    size_t bytes = sizeof(PoolChunk) + (size_t)pool->chunk * sizeof(RAVL_Node);
+    PoolChunk *c = (PoolChunk *)chunkAlloc(bytes, pool->placement);
+    if (c == NULL) {
+      return NULL;
+    }
+    c->next = pool->chunks;
+    c->bytes = bytes;
+    pool->chunks = c;
+    pool->used = 0;
+  }
+  return &pool->chunks->nodes[pool->used++];
+}
+
+void poolRelease(void *ctx, void *node) {
+  RAVL_Pool *pool = (RAVL_Pool *)ctx;
+  ((RAVL_Node *)node)->left = pool->free_list;
+  pool->free_list = (RAVL_Node *)node;
+}
+
+/* Releases every node of the tree rooted at 'node' to 'pool'. */
+void releaseTree(RAVL_Pool *pool, RAVL_Node *node) {
+  if (node == NULL)
+    return;
+  releaseTree(pool, node->left);
+  releaseTree(pool, node->right);
+  poolRelease(pool, node);
+}
+
+/* Copies the tree rooted at 'node' into 'pool' in pre-order. Returns NULL
+ * if memory runs out, after releasing whatever was copied.
+ */
+RAVL_Node *copyTree(RAVL_Pool *pool, RAVL_Node *node) {
+  if (node == NULL) {
+    return NULL;
+  }
+
+  RAVL_Node *copy = (RAVL_Node *)poolAlloc(pool);
+  if (copy == NULL) {
+    return NULL;
+  }
+  *copy = *node;
+  copy->left = copyTree(pool, node->left);
+  copy->right = copyTree(pool, node->right);
+  if ((node->left != NULL && copy->left == NULL) ||
+      (node->right != NULL && copy->right == NULL)) {
+    releaseTree(pool, copy->left);
+    releaseTree(pool, copy->right);
+    poolRelease(pool, copy);
+    return NULL;
+  }
+  return copy;
+}
+
+/*************************************************************************
+ ** Pool functions
+ *************************************************************************/
+
+RAVL_Pool *poolCreate(int chunk, int placement) {
+  RAVL_Pool *pool = (RAVL_Pool *)calloc(1, sizeof(RAVL_Pool));
+  if (pool == NULL) {
+    return NULL;
+  }
+
+  pool->chunk = chunk > 0 ? chunk : POOL_CHUNK;
+  pool->placement = placement;
+  pool->allocator.alloc = poolAlloc;
+  pool->allocator.release = poolRelease;
+  pool->allocator.ctx = pool;
+  return pool;
+}
+
+RAVL_Allocator *poolAllocator(RAVL_Pool *pool) { return &pool->allocator; }
+
+RAVL_Node *poolCopyTree(RAVL_Pool *pool, RAVL_Node *node) {
+  return copyTree(pool, node);
+}
+
+int poolLocalNode(void) {
+#ifdef RAVL_USE_NUMA
+  if (numa_available() >= 0) {
+    int cpu = sched_getcpu();
+    if (cpu >= 0) {
+      int node = numa_node_of_cpu(cpu);
+      return node >= 0 ? node : 0;
+    }
+  }
+#endif
+  return 0;
+}
+
+void poolDestroy(RAVL_Pool *pool) {
+  if (pool == NULL) {
+    return;
+  }
+
+  PoolChunk *c = pool->chunks;
+  while (c != NULL) {
+    PoolChunk *next = c->next;
+    chunkFree(c, pool->placement);
+    c = next;
+  }
+  free(pool);
+}
@@ -0,0 +1,58 @@
+/*
+ *  Header file for a node pool for RAVL trees.
+ *
+ *  A pool hands out nodes from large chunks instead of calling malloc() for
+ *  each one, and keeps released nodes on a free list for reuse. Install it
+ *  for all trees with setAllocator(poolAllocator(pool)).
+ *
+ *  When built with RAVL_USE_NUMA defined (and linked with -lnuma), a pool
+ *  can place its chunks on a given NUMA node or interleave them across all
+ *  nodes. Otherwise, or if the machine has no NUMA support, the placement
+ *  is ignored and chunks come from malloc().
+ *
+ *  A pool is not thread-safe; use one pool per thread, or lock around it.
+*/
+
+#include "RAVL_tree.h"
+
+#ifndef __RAVL_pool_header
+#define __RAVL_pool_header
+
+#define POOL_CHUNK 4096         // default number of nodes per chunk
+
+#define POOL_ANY -1             // placement: wherever malloc() puts it
+#define POOL_INTERLEAVED -2     // placement: pages spread over all nodes
+
+typedef struct ravl_pool RAVL_Pool;
+
+/* Returns a new, empty pool that allocates 'chunk' nodes at a time
+ * (POOL_CHUNK if 'chunk' is not positive). 'placement' is POOL_ANY,
+ * POOL_INTERLEAVED, or the number of the NUMA node to place chunks on.
+ * Returns NULL if memory runs out.
+*/
+RAVL_Pool* poolCreate(int chunk, int placement);
+
+/* Returns the allocator that takes nodes from 'pool', for setAllocator().
+*/
+RAVL_Allocator* poolAllocator(RAVL_Pool* pool);
+
+/* Returns the root of a copy of the RAVL tree rooted at 'node', of the same
+ * shape, whose nodes come from 'pool'. The copy is laid out in pre-order,
+ * so the top levels of the tree share a few cache lines and pages. Use it
+ * to give readers on each NUMA node a local read-only replica of a tree
+ * that no longer changes. Returns NULL if memory runs out (nothing is
+ * leaked).
+*/
+RAVL_Node* poolCopyTree(RAVL_Pool* pool, RAVL_Node* node);
+
+/* Returns the NUMA node the calling thread is running on, or 0 if that is
+ * unknown; use it to pick the replica made for that node.
+*/
+int poolLocalNode(void);
+
+/* Frees all memory of 'pool', including every node it handed out, in use or
+ * not. Do not use trees built from it afterwards.
+*/
+void poolDestroy(RAVL_Pool* pool);
+
+#endif
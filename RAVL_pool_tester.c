@@ -0,0 +1,173 @@
+/*
+ *  Checks pool copies of RAVL trees and measures NUMA-aware placement.
+ *
+ *  Usage: RAVL_pool_tester [keys [readers [lookups per reader]]]
+ *
+ *  Builds a tree of 'keys' random keys (default 1000000) from malloc'd
+ *  nodes and checks that poolCopyTree() copies it exactly, into a pool
+ *  interleaved over all NUMA nodes and into one pool per NUMA node. Then
+ *  'readers' threads (default: one per online CPU, each pinned to its CPU)
+ *  run random search() and rank() calls against three layouts and the
+ *  lookups per second of each are printed:
+ *
+ *    malloc       the original tree, wherever malloc() put its nodes
+ *    interleaved  one shared copy with pages spread over all nodes
+ *    replicas     one copy per node; each reader uses the copy made for
+ *                 the node poolLocalNode() says it runs on
+ *
+ *  The difference only shows on a multi-socket machine in a build with
+ *  RAVL_USE_NUMA; elsewhere all pools fall back to malloc() and there is a
+ *  single replica. The keys are random (see RAVL_TEST_SEED). Exits with
+ *  status 1 on the first failure.
+ *
+ *  Build: gcc -O2 RAVL_pool_tester.c RAVL_pool.c RAVL_tree.c -pthread
+ *         [-DRAVL_USE_NUMA -lnuma]
+ */
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
+#ifdef RAVL_USE_NUMA
+#include <numa.h>
+#endif
+
+#include "RAVL_pool.h"
+#include "RAVL_test.h"
+
+#define MAX_NODES 64  // NUMA nodes with a replica
+
+typedef struct reader {
+  pthread_t thread;
+  int cpu;
+  long found;
+} Reader;
+
+int keys;
+long lookups;
+int nodes;                        // NUMA nodes in the machine
+RAVL_Node* shared;                // tree every reader uses, or NULL
+RAVL_Node* replicas[MAX_NODES];   // replicas[n]: copy placed on node n
+
+void checkCopy(RAVL_Node* copy, RAVL_Node* node);
+double runReaders(int readers);
+void* readTree(void* arg);
+
+int main(int argc, char* argv[]) {
+  testSeed();
+  keys = argc > 1 ? atoi(argv[1]) : 1000000;
+  int readers = argc > 2 ? atoi(argv[2]) : (int)sysconf(_SC_NPROCESSORS_ONLN);
+  lookups = argc > 3 ? atol(argv[3]) : 1000000;
+  if (keys < 1 || readers < 1) {
+    fprintf(stderr, "need at least one key and one reader\n");
+    return 1;
+  }
+  nodes = 1;
+#ifdef RAVL_USE_NUMA
+  if (numa_available() >= 0) {
+    nodes = numa_max_node() + 1;
+  }
+#endif
+  CHECK(nodes <= MAX_NODES);
+
+  RAVL_Node* tree = NULL;
+  unsigned seed = test_seed;
+  for (int i = 0; i < keys; i++) {
+    tree = insert(tree, (int)testRandom(&seed), NULL);
+  }
+
+  RAVL_Pool* interleaved = poolCreate(0, POOL_INTERLEAVED);
+  CHECK(interleaved != NULL);
+  RAVL_Node* spread = poolCopyTree(interleaved, tree);
+  checkCopy(spread, tree);
+
+  RAVL_Pool* local[MAX_NODES];
+  for (int n = 0; n < nodes; n++) {
+    local[n] = poolCreate(0, n);
+    CHECK(local[n] != NULL);
+    replicas[n] = poolCopyTree(local[n], tree);
+    checkCopy(replicas[n], tree);
+  }
+  printf("copies ok\n");
+
+  printf("%d keys, %d readers, %d NUMA node(s):\n", tree->size, readers, nodes);
+  shared = tree;
+  printf("  malloc       %12.0f lookups/s\n", runReaders(readers));
+  shared = spread;
+  printf("  interleaved  %12.0f lookups/s\n", runReaders(readers));
+  shared = NULL;
+  printf("  replicas     %12.0f lookups/s\n", runReaders(readers));
+
+  for (int n = 0; n < nodes; n++) {
+    poolDestroy(local[n]);
+  }
+  poolDestroy(interleaved);
+  deleteTree(tree);
+  return 0;
+}
+
+/* Checks that 'copy' has the shape, keys and values of 'node' but none of
+ * its nodes.
+ */
+void checkCopy(RAVL_Node* copy, RAVL_Node* node) {
+  if (node == NULL) {
+    CHECK(copy == NULL);
+    return;
+  }
+  CHECK(copy != NULL && copy != node);
+  CHECK(copy->key == node->key && copy->value == node->value);
+  CHECK(copy->live == node->live);
+  CHECK(copy->height == node->height && copy->size == node->size);
+  checkCopy(copy->left, node->left);
+  checkCopy(copy->right, node->right);
+}
+
+/* Runs 'readers' pinned readers over the current layout and returns the
+ * lookups per second.
+ */
+double runReaders(int readers) {
+  Reader r[readers];
+  int cpus = (int)sysconf(_SC_NPROCESSORS_ONLN);
+
+  double start = testNow();
+  for (int i = 0; i < readers; i++) {
+    r[i].cpu = i % cpus;
+    r[i].found = 0;
+    pthread_create(&r[i].thread, NULL, readTree, &r[i]);
+  }
+  long found = 0;
+  for (int i = 0; i < readers; i++) {
+    pthread_join(r[i].thread, NULL);
+    found += r[i].found;
+  }
+  double seconds = testNow() - start;
+
+  CHECK(found > 0);
+  return readers * lookups / seconds;
+}
+
+void* readTree(void* arg) {
+  Reader* r = (Reader*)arg;
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(r->cpu, &set);
+  pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+
+  RAVL_Node* tree = shared;
+  if (tree == NULL) {
+    int n = poolLocalNode();
+    tree = replicas[n < nodes ? n : 0];
+  }
+
+  // replay the keys' insertion order: search() hits, rank() mostly misses
+  unsigned seed = test_seed;
+  for (long i = 0; i < lookups; i++) {
+    int key = (int)testRandom(&seed);
+    if (i & 1) {
+      r->found += search(tree, key) != NULL;
+    } else {
+      r->found += rank(tree, key ^ 1) != NOTIN;
+    }
+  }
+  return NULL;
+}
@@ -0,0 +1,254 @@
+/*
+ *  Read-only replicas of a RAVL tree.
+ *
+ *  Every slot sits on its own cache line and owns a version: a node pool
+ *  holding a pre-order copy of the master tree, built by a thread pinned to
+ *  the slot's CPUs so that first touch places it in their memory.
+ *
+ *  Each slot has two reader counts and a phase selecting one of them.
+ *  Readers increment the count of the current phase (checking that the
+ *  phase did not change meanwhile) before loading the slot's version. The
+ *  publisher swaps in the new version, flips the phase, and waits only for
+ *  the count of the old phase to drain: readers arriving after the flip
+ *  count towards the new phase and can only see the new version, so a
+ *  steady stream of them never holds the publisher up.
+ */
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+
+#include "RAVL_pool.h"
+#include "RAVL_replica.h"
+
+#define CACHE_LINE 64
+
+typedef struct replica_version {
+  RAVL_Pool* pool;   // owns every node of the copy
+  RAVL_Node* root;
+  long number;
+} ReplicaVersion;
+
+typedef struct replica_slot {
+  _Atomic(ReplicaVersion*) current;
+  atomic_int phase;       // which count new readers use
+  atomic_int readers[2];  // readers that entered in each phase
+} __attribute__((aligned(CACHE_LINE))) ReplicaSlot;
+
+typedef struct replica_build {
+  RAVL_Node* master;
+  long number;
+  int slot;
+  int slots;
+  ReplicaVersion* result;
+} ReplicaBuild;
+
+struct ravl_replicas {
+  ReplicaSlot* slots;
+  int n;
+  long version;             // number of the latest published version
+  pthread_mutex_t publish;  // serializes publishers
+};
+
+/*************************************************************************
+ ** Helper functions
+ *************************************************************************/
+
+/* Returns a new version numbered 'number' holding a copy of the tree
+ * rooted at 'master', or NULL if memory runs out.
+ */
+ReplicaVersion *versionCreate(RAVL_Node *master, long number) {
+  ReplicaVersion *v = (ReplicaVersion *)malloc(sizeof(ReplicaVersion));
+  if (v == NULL) {
+    return NULL;
+  }
+
+  int n = master == NULL ? 0 : master->size;
+  v->pool = poolCreate(n > 0 ? n : 1, POOL_ANY);  // one chunk holds the copy
+  v->root = NULL;
+  v->number = number;
+  if (v->pool != NULL && n > 0) {
+    v->root = poolCopyTree(v->pool, master);
+  }
+  if (v->pool == NULL || (n > 0 && v->root == NULL)) {
+    poolDestroy(v->pool);
+    free(v);
+    return NULL;
+  }
+  return v;
+}
+
+/* Builds the copy for slot 'build->slot' on the calling thread, after
+ * moving it onto the CPUs that use that slot.
+ */
+void *buildCopy(void *arg) {
+  ReplicaBuild *build = (ReplicaBuild *)arg;
+  cpu_set_t set;
+
+  CPU_ZERO(&set);
+  for (int cpu = build->slot; cpu < CPU_SETSIZE; cpu += build->slots) {
+    CPU_SET(cpu, &set);
+  }
+  pthread_setaffinity_np(pthread_self(), sizeof(set), &set);  // best effort
+
+  build->result = versionCreate(build->master, build->number);
+  return NULL;
+}
+
+void versionDestroy(ReplicaVersion *v) {
+  if (v == NULL) {
+    return;
+  }
+  poolDestroy(v->pool);
+  free(v);
+}
+
+/*************************************************************************
+ ** Replica functions
+ *************************************************************************/
+
+RAVL_Replicas *replicaCreate(int slots) {
+  if (slots < 1) {
+    slots = 1;
+  }
+
+  RAVL_Replicas *replicas = (RAVL_Replicas *)malloc(sizeof(RAVL_Replicas));
+  if (replicas == NULL) {
+    return NULL;
+  }
+  replicas->slots = (ReplicaSlot *)aligned_alloc(CACHE_LINE, slots * sizeof(ReplicaSlot));
+  if (replicas->slots == NULL) {
+    free(replicas);
+    return NULL;
+  }
+
+  replicas->n = slots;
+  replicas->version = 0;
+  pthread_mutex_init(&replicas->publish, NULL);
+  for (int i = 0; i < slots; i++) {
+    atomic_init(&replicas->slots[i].current, NULL);
+    atomic_init(&replicas->slots[i].phase, 0);
+    atomic_init(&replicas->slots[i].readers[0], 0);
+    atomic_init(&replicas->slots[i].readers[1], 0);
+  }
+  return replicas;
+}
+
+int replicaSlot(RAVL_Replicas *replicas) {
+  int cpu = sched_getcpu();
+  return cpu < 0 ? 0 : cpu % replicas->n;
+}
+
+long replicaPublish(RAVL_Replicas *replicas, RAVL_Node *master) {
+  pthread_mutex_lock(&replicas->publish);
+  long number = replicas->version + 1;
+
+  // make every copy first, so that a failure leaves all slots unchanged
+  int n = replicas->n;
+  ReplicaBuild *builds = (ReplicaBuild *)calloc(n, sizeof(ReplicaBuild));
+  pthread_t *threads = (pthread_t *)malloc(n * sizeof(pthread_t));
+  char *spawned = (char *)calloc(n, 1);
+  if (builds == NULL || threads == NULL || spawned == NULL) {
+    free(builds);
+    free(threads);
+    free(spawned);
+    pthread_mutex_unlock(&replicas->publish);
+    return -1;
+  }
+  for (int i = 0; i < n; i++) {
+    ReplicaBuild build = {master, number, i, n, NULL};
+    builds[i] = build;
+    spawned[i] = pthread_create(&threads[i], NULL, buildCopy, &builds[i]) == 0;
+    if (!spawned[i]) {
+      builds[i].result = versionCreate(master, number);  // here, then
+    }
+  }
+  int made = 0;
+  for (int i = 0; i < n; i++) {
+    if (spawned[i]) {
+      pthread_join(threads[i], NULL);
+    }
+    made += builds[i].result != NULL;
+  }
+  free(threads);
+  free(spawned);
+  if (made < n) {
+    for (int i = 0; i < n; i++) {
+      versionDestroy(builds[i].result);
+    }
+    free(builds);
+    pthread_mutex_unlock(&replicas->publish);
+    return -1;
+  }
+
+  for (int i = 0; i < n; i++) {
+    ReplicaSlot *slot = &replicas->slots[i];
+    ReplicaVersion *old = atomic_exchange(&slot->current, builds[i].result);
+    int was = atomic_fetch_xor(&slot->phase, 1);
+    while (atomic_load(&slot->readers[was]) != 0) {
+      sched_yield();
+    }
+    versionDestroy(old);
+  }
+
+  free(builds);
+  replicas->version = number;
+  pthread_mutex_unlock(&replicas->publish);
+  return number;
+}
+
+RAVL_Node *replicaEnter(RAVL_Replicas *replicas, int slot, int *ticket, long *version) {
+  ReplicaSlot *s = &replicas->slots[slot];
+  int phase = atomic_load(&s->phase);
+  atomic_fetch_add(&s->readers[phase], 1);
+  while (atomic_load(&s->phase) != phase) {  // a publisher flipped it: follow
+    atomic_fetch_sub(&s->readers[phase], 1);
+    phase = atomic_load(&s->phase);
+    atomic_fetch_add(&s->readers[phase], 1);
+  }
+  ReplicaVersion *v = atomic_load(&s->current);
+
+  *ticket = slot * 2 + phase;
+  if (version != NULL) {
+    *version = v == NULL ? 0 : v->number;
+  }
+  return v == NULL ? NULL : v->root;
+}
+
+void replicaExit(RAVL_Replicas *replicas, int ticket) {
+  atomic_fetch_sub(&replicas->slots[ticket / 2].readers[ticket % 2], 1);
+}
+
+int replicaRank(RAVL_Replicas *replicas, int slot, int key) {
+  int ticket;
+  int r = rank(replicaEnter(replicas, slot, &ticket, NULL), key);
+  replicaExit(replicas, ticket);
+  return r;
+}
+
+int replicaFindRank(RAVL_Replicas *replicas, int slot, int rank, int *key, void **value) {
+  int ticket;
+  RAVL_Node *node = findRank(replicaEnter(replicas, slot, &ticket, NULL), rank);
+
+  if (node != NULL) {
+    *key = node->key;
+    if (value != NULL) {
+      *value = node->value;
+    }
+  }
+  replicaExit(replicas, ticket);
+  return node != NULL;
+}
+
+void replicaDestroy(RAVL_Replicas *replicas) {
+  if (replicas == NULL) {
+    return;
+  }
+  for (int i = 0; i < replicas->n; i++) {
+    versionDestroy(atomic_load(&replicas->slots[i].current));
+  }
+  pthread_mutex_destroy(&replicas->publish);
+  free(replicas->slots);
+  free(replicas);
+}
@@ -0,0 +1,68 @@
+/*
+ *  Header file for read-only replicas of a RAVL tree.
+ *
+ *  A replica set keeps one private copy of a tree per reader slot (e.g. per
+ *  core, or per group of cores sharing a cache). Readers in different slots
+ *  never touch the same nodes or counters, so hot rank()/findRank() queries
+ *  do not bounce cache lines between cores. The owner of the master tree
+ *  publishes a new version to all slots at once whenever it wants readers to
+ *  see its changes; each slot switches to the new copy atomically.
+ *
+ *  Any number of threads may read concurrently with one publisher.
+*/
+
+#include "RAVL_tree.h"
+
+#ifndef __RAVL_replica_header
+#define __RAVL_replica_header
+
+typedef struct ravl_replicas RAVL_Replicas;
+
+/* Returns a new replica set with 'slots' reader slots, all holding an empty
+ * tree. Returns NULL if memory runs out.
+*/
+RAVL_Replicas* replicaCreate(int slots);
+
+/* Returns a suitable slot for the calling thread: the number of the CPU it
+ * is running on, modulo the number of slots.
+*/
+int replicaSlot(RAVL_Replicas* replicas);
+
+/* Copies the RAVL tree rooted at 'master' into every slot of 'replicas'
+ * and switches each slot to its new copy. Each copy is made by a thread
+ * pinned to the CPUs that replicaSlot() maps to that slot, so its memory is
+ * local to them. Returns the new version number (1 for the first publish),
+ * or -1 if memory ran out, in which case readers keep seeing the previous
+ * version. Frees each previous copy once the readers that entered the slot
+ * before the switch are done with it; readers arriving later do not delay
+ * it. Publishes are serialized.
+*/
+long replicaPublish(RAVL_Replicas* replicas, RAVL_Node* master);
+
+/* Starts reading slot 'slot' and returns the root of its current copy.
+ * The copy must not be modified, and stays valid until the matching
+ * replicaExit(), to which the value stored in 'ticket' must be passed.
+ * Stores the copy's version number in 'version' if it is not NULL. Keep
+ * read sections short: publishing waits for them.
+*/
+RAVL_Node* replicaEnter(RAVL_Replicas* replicas, int slot, int* ticket, long* version);
+
+/* Ends the read section started by the replicaEnter() that stored 'ticket'.
+*/
+void replicaExit(RAVL_Replicas* replicas, int ticket);
+
+/* Returns the rank of 'key' in the current copy of slot 'slot', or NOTIN.
+*/
+int replicaRank(RAVL_Replicas* replicas, int slot, int key);
+
+/* Stores the key with rank 'rank' in the current copy of slot 'slot' in
+ * 'key', and its value in 'value' if it is not NULL. Returns 1 if there is
+ * such a rank, and 0 (storing nothing) otherwise.
+*/
+int replicaFindRank(RAVL_Replicas* replicas, int slot, int rank, int* key, void** value);
+
+/* Frees 'replicas' and all its copies. No reader may be active.
+*/
+void replicaDestroy(RAVL_Replicas* replicas);
+
+#endif
@@ -0,0 +1,445 @@
+/*
+ *  An indexable skip list with lazy, fine-grained locking.
+ *
+ *  Each node is linked into levels 0 .. level - 1; a node reaches level i+1
+ *  with probability 1/4. The span of a link at level i is the number of
+ *  level-0 steps it covers. Links to the end of a level keep no span: no
+ *  query reads it. The head is a sentinel linked into every level.
+ *
+ *  Readers never lock. Writers lock a node's spin lock before changing its
+ *  links or spans, and only ever take locks in decreasing key order (the
+ *  head last), so no two writers can wait for each other. An insert finds
+ *  the predecessors of its key, locks those of the levels it joins,
+ *  validates that they are unmarked and still point where the search
+ *  found, and links the node at all those levels at once. A delete marks
+ *  the node under its lock (the key is gone from then on), then unlinks it
+ *  the same way. Removed nodes are retired through the epoch domain.
+ *
+ *  At the levels above its own, a node only changes the span of the one
+ *  link over it, and does so one level at a time, bottom up on insert and
+ *  top down on delete, each under the lock of that link's node. A node's
+ *  'counted' field says how far it has got: the node is counted in the
+ *  span over it at level i exactly when counted > i. A node over which a
+ *  level ends counts as included at that level and every level above, so
+ *  its walk up stops there. Splitting a link at level i when linking a new
+ *  node needs the number of keys between the link's node and the new one:
+ *  the insert walks level 0 between them and counts the nodes with
+ *  counted > i. It holds the lock that every such count change needs, so
+ *  the result is exact.
+ */
+
+#define _GNU_SOURCE
+#include <sched.h>
+#include <stdint.h>
+
+#include "RAVL_skiplist.h"
+
+// reads or writes a node field that other threads may be reading
+#define LOAD(field) __atomic_load_n(&(field), __ATOMIC_RELAXED)
+#define STORE(field, v) __atomic_store_n(&(field), (v), __ATOMIC_RELAXED)
+// reads or writes a pointer to a node or value, publishing what it points to
+#define FOLLOW(field) __atomic_load_n(&(field), __ATOMIC_ACQUIRE)
+#define LINK(field, v) __atomic_store_n(&(field), (v), __ATOMIC_RELEASE)
+
+#define SPINS 64  // failed lock attempts before a writer starts yielding
+
+typedef struct sl_node {
+  int key;
+  void* value;
+  int level;
+  unsigned lock;  // spin lock, held while changing the node's links or spans
+  int marked;     // deleted; set under the lock
+  int linked;     // linked into its levels and counted at every level above
+  int counted;    // counted in the span over the node at levels below this
+  struct sl_link {
+    struct sl_node* next;
+    int span;
+  } links[];
+} SLNode;
+
+struct ravl_skiplist {
+  SLNode* head;
+  int level;   // levels that may be in use; only grows
+  int length;  // number of keys
+  RAVL_Epoch* epoch;
+};
+
+static __thread unsigned int level_seed = 0;  // random level generator state
+
+/*************************************************************************
+ ** Helper functions
+ *************************************************************************/
+
+SLNode *slNode(int key, void *value, int level) {
+  SLNode *node = (SLNode *)malloc(sizeof(SLNode) + level * sizeof(struct sl_link));
+  if (node == NULL) {
+    return NULL;
+  }
+  node->key = key;
+  node->value = value;
+  node->level = level;
+  node->lock = 0;
+  node->marked = 0;
+  node->linked = 0;
+  node->counted = 0;
+  for (int i = 0; i < level; i++) {
+    node->links[i].next = NULL;
+    node->links[i].span = 0;
+  }
+  return node;
+}
+
+/* Returns a random level for a new node: 1 with probability 3/4, 2 with
+ * probability 3/16, and so on.
+ */
+int randomLevel(void) {
+  int level = 1;
+
+  if (level_seed == 0) {  // a different sequence for every thread
+    level_seed = 2463534242u ^ (unsigned int)(uintptr_t)&level_seed;
+  }
+  level_seed ^= level_seed << 13;  // xorshift32
+  level_seed ^= level_seed >> 17;
+  level_seed ^= level_seed << 5;
+  unsigned int bits = level_seed;
+  while ((bits & 3) == 0 && level < SKIPLIST_MAX_LEVEL) {
+    level++;
+    bits >>= 2;
+    if (bits == 0) {
+      break;
+    }
+  }
+  return level;
+}
+
+void lockNode(SLNode *node) {
+  for (int spins = 0;; spins++) {
+    unsigned v = 0;
+    if (__atomic_compare_exchange_n(&node->lock, &v, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+      return;
+    }
+    if (spins >= SPINS) {
+      sched_yield();
+    }
+  }
+}
+
+void unlockNode(SLNode *node) { __atomic_store_n(&node->lock, 0, __ATOMIC_RELEASE); }
+
+/* Stores in 'preds[i]' the last node at level i whose key is smaller than
+ * 'key' and in 'succs[i]' the node after it, for every level, and in
+ * 'rank' (if it is not NULL) the rank of 'preds[0]', 0 for the head.
+ * Returns 'succs[0]', which holds 'key' if any node does.
+ */
+SLNode *findPath(RAVL_SkipList *list, int key, SLNode **preds, SLNode **succs, int *rank) {
+  SLNode *x = list->head;
+  int top = LOAD(list->level);
+  int r = 0;
+
+  for (int i = SKIPLIST_MAX_LEVEL - 1; i >= 0; i--) {
+    SLNode *next = i < top ? FOLLOW(x->links[i].next) : NULL;
+    while (next != NULL && next->key < key) {
+      r += LOAD(x->links[i].span);
+      x = next;
+      next = FOLLOW(x->links[i].next);
+    }
+    preds[i] = x;
+    succs[i] = next;
+  }
+  if (rank != NULL) {
+    *rank = r;
+  }
+  return succs[0];
+}
+
+/* Returns 1 if 'x' holds 'key' and is in the list, 0 otherwise. */
+int isKey(SLNode *x, int key) {
+  return x != NULL && x->key == key && LOAD(x->linked) && !LOAD(x->marked);
+}
+
+/* Locks the nodes 'preds[0 .. n-1]', each once, bottom up. */
+void lockPreds(SLNode **preds, int n) {
+  for (int i = 0; i < n; i++) {
+    if (i == 0 || preds[i] != preds[i - 1]) {
+      lockNode(preds[i]);
+    }
+  }
+}
+
+void unlockPreds(SLNode **preds, int n) {
+  for (int i = 0; i < n; i++) {
+    if (i == 0 || preds[i] != preds[i - 1]) {
+      unlockNode(preds[i]);
+    }
+  }
+}
+
+/* Locks and returns the node whose level-'i' link is over 'key' (the last
+ * one at that level with a smaller key), searching again from the head
+ * while the node in 'preds[i]' turns out to be stale.
+ */
+SLNode *lockCover(RAVL_SkipList *list, int key, int i, SLNode **preds, SLNode **succs) {
+  for (;;) {
+    SLNode *p = preds[i];
+    lockNode(p);
+    SLNode *next = FOLLOW(p->links[i].next);
+    if (!LOAD(p->marked) && (next == NULL || next->key > key)) {
+      return p;
+    }
+    unlockNode(p);
+    findPath(list, key, preds, succs, NULL);
+  }
+}
+
+/* Returns the number of nodes after 'from' and before 'to' at level 0 that
+ * are counted at level 'i'. The caller holds 'from', whose level-'i' link
+ * is over all of them.
+ */
+int countBetween(SLNode *from, SLNode *to, int i) {
+  int n = 0;
+  for (SLNode *y = FOLLOW(from->links[0].next); y != to; y = FOLLOW(y->links[0].next)) {
+    n += LOAD(y->counted) > i;
+  }
+  return n;
+}
+
+/* Links 'x' after 'preds[i]' at its levels, which the caller has locked
+ * and validated, splitting their spans.
+ */
+void linkNode(SLNode *x, SLNode **preds, SLNode **succs) {
+  for (int i = 0; i < x->level; i++) {
+    int before = i == 0 ? 0 : countBetween(preds[i], x, i);
+    STORE(x->links[i].span, succs[i] == NULL ? 0 : LOAD(preds[i]->links[i].span) - before);
+    STORE(x->links[i].next, succs[i]);
+    STORE(preds[i]->links[i].span, before + 1);
+    LINK(preds[i]->links[i].next, x);
+  }
+  STORE(x->counted, x->level);
+}
+
+/*************************************************************************
+ ** Skip list functions
+ *************************************************************************/
+
+RAVL_SkipList *slCreate(RAVL_Epoch *epoch) {
+  RAVL_SkipList *list = (RAVL_SkipList *)malloc(sizeof(RAVL_SkipList));
+  if (list == NULL) {
+    return NULL;
+  }
+  list->head = slNode(0, NULL, SKIPLIST_MAX_LEVEL);
+  if (list->head == NULL) {
+    free(list);
+    return NULL;
+  }
+
+  list->head->linked = 1;
+  list->level = 1;
+  list->length = 0;
+  list->epoch = epoch;
+  return list;
+}
+
+int slInsert(RAVL_SkipList *list, int key, void *value) {
+  SLNode *preds[SKIPLIST_MAX_LEVEL], *succs[SKIPLIST_MAX_LEVEL];
+  SLNode *node = NULL;
+  int status = 0;
+
+  epochEnter(list->epoch);
+  for (;;) {
+    SLNode *x = findPath(list, key, preds, succs, NULL);
+    if (x != NULL && x->key == key) {
+      lockNode(x);
+      int present = LOAD(x->linked) && !LOAD(x->marked);
+      if (present) {
+        LINK(x->value, value);
+      }
+      unlockNode(x);
+      if (present) {
+        break;
+      }
+      sched_yield();  // being inserted or deleted: wait for that to finish
+      continue;
+    }
+
+    if (node == NULL) {
+      node = slNode(key, value, randomLevel());
+      if (node == NULL) {
+        status = -1;
+        break;
+      }
+      int top = LOAD(list->level);
+      while (top < node->level &&
+             !__atomic_compare_exchange_n(&list->level, &top, node->level, 0,
+                                          __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+      }
+      if (top < node->level) {  // the search may have skipped the new levels
+        continue;
+      }
+    }
+
+    lockPreds(preds, node->level);
+    int valid = 1;
+    for (int i = 0; valid && i < node->level; i++) {
+      valid = !LOAD(preds[i]->marked) && (succs[i] == NULL || !LOAD(succs[i]->marked)) &&
+              FOLLOW(preds[i]->links[i].next) == succs[i];
+    }
+    if (valid) {
+      linkNode(node, preds, succs);
+    }
+    unlockPreds(preds, node->level);
+    if (!valid) {
+      continue;
+    }
+
+    for (int i = node->level; i < SKIPLIST_MAX_LEVEL; i++) {  // links over the node
+      SLNode *p = lockCover(list, key, i, preds, succs);
+      int end = FOLLOW(p->links[i].next) == NULL;
+      if (!end) {
+        STORE(p->links[i].span, LOAD(p->links[i].span) + 1);
+      }
+      STORE(node->counted, end ? SKIPLIST_MAX_LEVEL : i + 1);
+      unlockNode(p);
+      if (end) {
+        break;
+      }
+    }
+    __atomic_store_n(&node->linked, 1, __ATOMIC_RELEASE);
+    __atomic_fetch_add(&list->length, 1, __ATOMIC_RELAXED);
+    node = NULL;
+    break;
+  }
+  epochExit(list->epoch);
+  free(node);
+  return status;
+}
+
+void slDelete(RAVL_SkipList *list, int key) {
+  SLNode *preds[SKIPLIST_MAX_LEVEL], *succs[SKIPLIST_MAX_LEVEL];
+
+  epochEnter(list->epoch);
+  SLNode *x = findPath(list, key, preds, succs, NULL);
+  if (x == NULL || x->key != key) {
+    epochExit(list->epoch);
+    return;
+  }
+  lockNode(x);
+  if (!LOAD(x->linked) || LOAD(x->marked)) {  // not in yet, or already gone
+    unlockNode(x);
+    epochExit(list->epoch);
+    return;
+  }
+  STORE(x->marked, 1);
+  __atomic_fetch_sub(&list->length, 1, __ATOMIC_RELAXED);
+
+  // find the level where the links over x end, and stop counting x there
+  int top = x->level;
+  for (; top < SKIPLIST_MAX_LEVEL; top++) {
+    SLNode *p = lockCover(list, key, top, preds, succs);
+    int end = FOLLOW(p->links[top].next) == NULL;
+    if (end) {
+      STORE(x->counted, top);
+    }
+    unlockNode(p);
+    if (end) {
+      break;
+    }
+  }
+  for (int i = top - 1; i >= x->level; i--) {  // then uncount it below, top down
+    SLNode *p = lockCover(list, key, i, preds, succs);
+    if (FOLLOW(p->links[i].next) != NULL) {
+      STORE(p->links[i].span, LOAD(p->links[i].span) - 1);
+    }
+    STORE(x->counted, i);
+    unlockNode(p);
+  }
+
+  for (;;) {
+    lockPreds(preds, x->level);
+    int valid = 1;
+    for (int i = 0; valid && i < x->level; i++) {
+      valid = !LOAD(preds[i]->marked) && FOLLOW(preds[i]->links[i].next) == x;
+    }
+    if (valid) {
+      break;
+    }
+    unlockPreds(preds, x->level);
+    findPath(list, key, preds, succs, NULL);
+  }
+  for (int i = x->level - 1; i >= 0; i--) {
+    SLNode *next = x->links[i].next;
+    STORE(preds[i]->links[i].span,
+          next == NULL ? 0 : LOAD(preds[i]->links[i].span) + x->links[i].span - 1);
+    LINK(preds[i]->links[i].next, next);
+  }
+  STORE(x->counted, 0);
+  unlockPreds(preds, x->level);
+  unlockNode(x);
+
+  epochRetire(list->epoch, (RAVL_Node *)x);
+  epochExit(list->epoch);
+}
+
+int slSearch(RAVL_SkipList *list, int key, void **value) {
+  SLNode *preds[SKIPLIST_MAX_LEVEL], *succs[SKIPLIST_MAX_LEVEL];
+
+  epochEnter(list->epoch);
+  SLNode *x = findPath(list, key, preds, succs, NULL);
+  int found = isKey(x, key);
+  if (found && value != NULL) {
+    *value = FOLLOW(x->value);
+  }
+  epochExit(list->epoch);
+  return found;
+}
+
+int slRank(RAVL_SkipList *list, int key) {
+  SLNode *preds[SKIPLIST_MAX_LEVEL], *succs[SKIPLIST_MAX_LEVEL];
+  int rank;
+
+  epochEnter(list->epoch);
+  SLNode *x = findPath(list, key, preds, succs, &rank);
+  int r = isKey(x, key) ? rank + 1 : NOTIN;
+  epochExit(list->epoch);
+  return r;
+}
+
+int slFindRank(RAVL_SkipList *list, int rank, int *key, void **value) {
+  epochEnter(list->epoch);
+  SLNode *x = list->head;
+  int traversed = 0;
+
+  for (int i = LOAD(list->level) - 1; i >= 0 && traversed < rank; i--) {
+    SLNode *next = FOLLOW(x->links[i].next);
+    while (next != NULL && traversed + LOAD(x->links[i].span) <= rank) {
+      traversed += LOAD(x->links[i].span);
+      x = next;
+      next = FOLLOW(x->links[i].next);
+    }
+  }
+
+  int found = (x != list->head && traversed == rank);
+  if (found) {
+    *key = x->key;
+    if (value != NULL) {
+      *value = FOLLOW(x->value);
+    }
+  }
+  epochExit(list->epoch);
+  return found;
+}
+
+int slSize(RAVL_SkipList *list) { return LOAD(list->length); }
+
+void slDestroy(RAVL_SkipList *list) {
+  if (list == NULL) {
+    return;
+  }
+
+  SLNode *x = list->head;
+  while (x != NULL) {
+    SLNode *next = x->links[0].next;
+    free(x);
+    x = next;
+  }
+  free(list);
+}
@@ -0,0 +1,77 @@
+/*
+ *  Header file for an indexable skip list: an alternative engine with the
+ *  same search/insert/delete/rank/findRank semantics as the RAVL tree.
+ *
+ *  Every forward link records its span (how many keys it skips), which
+ *  gives rank and find-rank queries in expected O(log n) without any
+ *  rebalancing. Writers only relink the few nodes next to the key they
+ *  change, instead of rotating up to the root.
+ *
+ *  All functions are thread-safe. Queries never lock. Writers lock only the
+ *  nodes whose links or spans they change, one level at a time above the
+ *  levels of the node they add or remove, so writers working on different
+ *  parts of the list run in parallel. Sizes and ranks are exact whenever no
+ *  writer is active; a rank or size read while writers are active may
+ *  count an unfinished insert or delete as done or as not yet started. The
+ *  list is not lock-free: an insert or delete has to change a link and its
+ *  span together, which single-word compare-and-swap cannot do without
+ *  giving up exact ranks. Removed nodes are retired through an epoch
+ *  domain, so a reader that is still looking at one never sees freed
+ *  memory. RAVL_skiplist_tester.c measures the list against a mutex-wrapped
+ *  RAVL tree.
+ *
+ *  Setup: create an epoch domain with epochCreate(NULL) (the list's nodes
+ *  come from malloc() and go back to free()) and have every thread that
+ *  uses the list call epochRegister(epoch) first.
+*/
+
+#include "RAVL_epoch.h"
+#include "RAVL_tree.h"
+
+#ifndef __RAVL_skiplist_header
+#define __RAVL_skiplist_header
+
+#define SKIPLIST_MAX_LEVEL 32
+
+typedef struct ravl_skiplist RAVL_SkipList;
+
+/* Returns a new, empty skip list whose removed nodes are retired through
+ * 'epoch'. Returns NULL if memory runs out.
+*/
+RAVL_SkipList* slCreate(RAVL_Epoch* epoch);
+
+/* Inserts the key/value pair 'key'/'value' into 'list'. If 'key' is already
+ * in 'list', updates the value associated with it to 'value'. Returns 0 on
+ * success, -1 if memory runs out.
+*/
+int slInsert(RAVL_SkipList* list, int key, void* value);
+
+/* Deletes 'key' from 'list'. If 'key' is not in 'list', it is unchanged.
+*/
+void slDelete(RAVL_SkipList* list, int key);
+
+/* Returns 1 and stores the value associated with 'key' in 'value' (if it
+ * is not NULL) if 'key' is in 'list'. Returns 0 otherwise.
+*/
+int slSearch(RAVL_SkipList* list, int key, void** value);
+
+/* Returns the rank of 'key' in 'list', or NOTIN if 'key' is not in it.
+*/
+int slRank(RAVL_SkipList* list, int key);
+
+/* Stores the key with rank 'rank' in 'list' in 'key', and its value in
+ * 'value' if it is not NULL. Returns 1 if there is such a rank, and 0
+ * (storing nothing) otherwise.
+*/
+int slFindRank(RAVL_SkipList* list, int rank, int* key, void** value);
+
+/* Returns the number of keys in 'list'.
+*/
+int slSize(RAVL_SkipList* list);
+
+/* Frees 'list', except for removed nodes still waiting in its epoch
+ * domain. No other thread may be using it.
+*/
+void slDestroy(RAVL_SkipList* list);
+
+#endif
@@ -0,0 +1,267 @@
+/*
+ *  Checks the indexable skip list against the RAVL tree, then benchmarks
+ *  both under concurrent load.
+ *
+ *  Usage: RAVL_skiplist_tester [max threads [writes per 100 operations]]
+ *
+ *  The check applies the same random inserts and deletes to a skip list
+ *  and to a RAVL tree and compares search, rank, findRank and size after
+ *  each batch. Then 'max threads' threads insert and delete random keys of
+ *  their own, mixed with queries, on one skip list at the same time, each
+ *  keeping a RAVL tree of its keys; once they are done, the list must
+ *  match the union of those trees. The check exits with status 1 on the
+ *  first difference. The benchmark then runs 1, 2, 4, ... up to 'max
+ *  threads' (default 64) threads doing random operations on a shared skip
+ *  list and on a RAVL tree wrapped in a mutex, and prints the throughput of
+ *  each. Set RAVL_TEST_SEED to vary the random operations.
+ *
+ *  Build: gcc -O2 RAVL_skiplist_tester.c RAVL_skiplist.c RAVL_epoch.c RAVL_tree.c
+ *         -pthread
+ */
+#define _GNU_SOURCE
+#include <pthread.h>
+
+#include "RAVL_skiplist.h"
+#include "RAVL_test.h"
+
+#define KEYS 100000        // keys drawn from 0 .. KEYS - 1
+#define CHECK_ROUNDS 200   // batches of the check
+#define CHECK_BATCH 500    // operations per batch
+#define OPERATIONS 400000  // benchmark operations, split among the threads
+
+typedef struct bench_thread {
+  pthread_t thread;
+  int use_list;  // 1: the skip list, 0: the locked RAVL tree
+  long operations;
+  unsigned seed;
+} BenchThread;
+
+typedef struct check_thread {
+  pthread_t thread;
+  int id;
+  int threads;
+  RAVL_Node* keys;  // the keys this thread left in the list
+} CheckThread;
+
+RAVL_Epoch* epoch;
+RAVL_SkipList* list;
+RAVL_Node* tree;
+pthread_mutex_t tree_lock = PTHREAD_MUTEX_INITIALIZER;
+int writes = 50;  // writes per 100 operations
+
+void checkAgainstTree(void);
+void checkConcurrent(int threads);
+void* checkThread(void* arg);
+double runBench(int threads, int use_list);
+void* benchThread(void* arg);
+
+int main(int argc, char* argv[]) {
+  testSeed();
+  int max_threads = argc > 1 ? atoi(argv[1]) : 64;
+  if (argc > 2) {
+    writes = atoi(argv[2]);
+  }
+
+  epoch = epochCreate(NULL);
+  CHECK(epoch != NULL && epochRegister(epoch) == 0);
+
+  checkAgainstTree();
+  checkConcurrent(max_threads);
+  printf("check ok\n");
+
+  printf("threads  skip list ops/s  locked tree ops/s  (%d%% writes)\n", writes);
+  for (int threads = 1; threads <= max_threads; threads *= 2) {
+    double sl = runBench(threads, 1);
+    double rt = runBench(threads, 0);
+    printf("%7d  %15.0f  %17.0f\n", threads, sl, rt);
+  }
+
+  epochUnregister(epoch);
+  epochDestroy(epoch);
+  return 0;
+}
+
+void checkAgainstTree(void) {
+  RAVL_SkipList* l = slCreate(epoch);
+  RAVL_Node* t = NULL;
+  unsigned seed = test_seed;
+  CHECK(l != NULL);
+
+  for (int round = 0; round < CHECK_ROUNDS; round++) {
+    for (int i = 0; i < CHECK_BATCH; i++) {
+      unsigned r = testRandom(&seed);
+      int key = r % 2000 - 1000;
+      if (r & (1 << 20)) {
+        CHECK(slInsert(l, key, (void*)(long)(key + round)) == 0);
+        t = insert(t, key, (void*)(long)(key + round));
+      } else {
+        slDelete(l, key);
+        t = delete(t, key);
+      }
+    }
+
+    int n = t == NULL ? 0 : t->size;
+    CHECK(slSize(l) == n);
+    for (int key = -1001; key <= 1000; key++) {
+      void* value;
+      RAVL_Node* node = search(t, key);
+      CHECK(slSearch(l, key, &value) == (node != NULL));
+      CHECK(node == NULL || value == node->value);
+      CHECK(slRank(l, key) == rank(t, key));
+    }
+    for (int r = 0; r <= n + 1; r++) {
+      int key;
+      RAVL_Node* node = findRank(t, r);
+      CHECK(slFindRank(l, r, &key, NULL) == (node != NULL));
+      CHECK(node == NULL || key == node->key);
+    }
+  }
+
+  slDestroy(l);
+  deleteTree(t);
+}
+
+void checkConcurrent(int threads) {
+  CheckThread check[threads];
+  RAVL_Node* t = NULL;
+
+  list = slCreate(epoch);
+  CHECK(list != NULL);
+  for (int i = 0; i < threads; i++) {
+    check[i].id = i;
+    check[i].threads = threads;
+    pthread_create(&check[i].thread, NULL, checkThread, &check[i]);
+  }
+  int* keys = (int*)malloc(KEYS * sizeof(int));
+  CHECK(keys != NULL);
+  for (int i = 0; i < threads; i++) {
+    pthread_join(check[i].thread, NULL);
+    int n = flattenTree(check[i].keys, keys, NULL);
+    for (int j = 0; j < n; j++) {
+      t = insert(t, keys[j], NULL);
+    }
+    deleteTree(check[i].keys);
+  }
+  free(keys);
+
+  int n = t == NULL ? 0 : t->size;
+  CHECK(slSize(list) == n);
+  for (int key = 0; key < KEYS; key++) {
+    CHECK(slRank(list, key) == rank(t, key));
+  }
+  for (int r = 0; r <= n + 1; r++) {
+    int key;
+    RAVL_Node* node = findRank(t, r);
+    CHECK(slFindRank(list, r, &key, NULL) == (node != NULL));
+    CHECK(node == NULL || key == node->key);
+  }
+
+  slDestroy(list);
+  deleteTree(t);
+}
+
+/* Inserts and deletes random keys that are 'id' modulo 'threads', with
+ * queries in between, recording the keys it leaves in the list.
+ */
+void* checkThread(void* arg) {
+  CheckThread* c = (CheckThread*)arg;
+  unsigned seed = test_seed * 1000 + (unsigned)c->id;
+  c->keys = NULL;
+  CHECK(epochRegister(epoch) == 0);
+
+  for (int i = 0; i < CHECK_ROUNDS * CHECK_BATCH / 4; i++) {
+    unsigned r = testRandom(&seed);
+    int key = (int)(r % (KEYS / c->threads)) * c->threads + c->id;
+    int k;
+    switch ((r >> 20) % 4) {
+      case 0:
+      case 1:
+        CHECK(slInsert(list, key, NULL) == 0);
+        c->keys = insert(c->keys, key, NULL);
+        break;
+      case 2:
+        slDelete(list, key);
+        c->keys = delete(c->keys, key);
+        break;
+      default:
+        CHECK(slSearch(list, key, NULL) == (search(c->keys, key) != NULL));
+        slFindRank(list, key, &k, NULL);
+    }
+  }
+
+  epochUnregister(epoch);
+  return NULL;
+}
+
+/* Fills the engine with half of the keys, runs 'threads' threads on it and
+ * returns the operations per second.
+ */
+double runBench(int threads, int use_list) {
+  BenchThread bench[threads];
+
+  list = slCreate(epoch);
+  tree = NULL;
+  CHECK(list != NULL);
+  for (int key = 0; key < KEYS; key += 2) {
+    if (use_list) {
+      slInsert(list, key, NULL);
+    } else {
+      tree = insert(tree, key, NULL);
+    }
+  }
+
+  double start = testNow();
+  for (int i = 0; i < threads; i++) {
+    bench[i].use_list = use_list;
+    bench[i].operations = OPERATIONS / threads;
+    bench[i].seed = test_seed * 1000 + (unsigned)i;
+    pthread_create(&bench[i].thread, NULL, benchThread, &bench[i]);
+  }
+  for (int i = 0; i < threads; i++) {
+    pthread_join(bench[i].thread, NULL);
+  }
+  double seconds = testNow() - start;
+
+  slDestroy(list);
+  deleteTree(tree);
+  return OPERATIONS / threads * threads / seconds;
+}
+
+void* benchThread(void* arg) {
+  BenchThread* b = (BenchThread*)arg;
+  CHECK(epochRegister(epoch) == 0);
+
+  for (long i = 0; i < b->operations; i++) {
+    unsigned r = testRandom(&b->seed);
+    int key = r % KEYS;
+    int op = (r >> 17) % 100;  // < writes: update, otherwise a query
+
+    if (b->use_list) {
+      if (op < writes / 2) {
+        slInsert(list, key, NULL);
+      } else if (op < writes) {
+        slDelete(list, key);
+      } else if (op & 1) {
+        slRank(list, key);
+      } else {
+        int k;
+        slFindRank(list, key / 2 + 1, &k, NULL);
+      }
+      continue;
+    }
+
+    pthread_mutex_lock(&tree_lock);
+    if (op < writes / 2) {
+      tree = insert(tree, key, NULL);
+    } else if (op < writes) {
+      tree = delete(tree, key);
+    } else if (op & 1) {
+      rank(tree, key);
+    } else {
+      findRank(tree, key / 2 + 1);
+    }
+    pthread_mutex_unlock(&tree_lock);
+  }
+  epochUnregister(epoch);
+  return NULL;
+}
@@ -0,0 +1,483 @@
+/*
+ *  Saving RAVL trees to disk and loading them back.
+ *
+ *  Background snapshots are written by a forked child process, which walks
+ *  its copy-on-write view of the tree directly, so the tree may keep
+ *  changing and no copy of the keys is made up front. The child only makes
+ *  system calls (no malloc, no stdio), so it is safe to fork from a
+ *  multithreaded process. A snapshotStart() job also shares a counter with
+ *  its child, which the child advances after every SNAPSHOT_CHUNK keys.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "RAVL_snapshot.h"
+
+// state of a forked child's in-order walk
+typedef struct tree_writer {
+  int fd;
+  int* buf;     // SNAPSHOT_CHUNK keys, allocated before the fork
+  int n;        // keys in 'buf'
+  off_t off;    // file offset of the next chunk
+  int status;   // 0 until a write fails
+  atomic_long* written;  // keys written so far, or NULL
+} TreeWriter;
+
+struct snapshot_job {
+  pid_t pid;            // the child writing the snapshot
+  long n;               // number of keys
+  atomic_long* written; // keys written so far, in memory shared with the child
+};
+
+/*************************************************************************
+ ** Helper functions
+ *************************************************************************/
+
+/* Writes 'len' bytes from 'buf' to 'fd' at offset 'off', retrying short
+ * writes. Returns 0 on success, -1 on failure.
+ */
+int pwriteAll(int fd, const void *buf, size_t len, off_t off) {
+  const char *p = (const char *)buf;
+
+  while (len > 0) {
+    ssize_t put = pwrite(fd, p, len, off);
+    if (put < 0) {
+      return -1;
+    }
+    p += put;
+    off += put;
+    len -= put;
+  }
+  return 0;
+}
+
+/* Writes the file 'path' consisting of the 'hlen' header words 'header'
+ * followed by the 'n' keys 'keys'. The file is written under a temporary
+ * name and renamed into place. Returns 0 on success, -1 on failure.
+ */
+int writeKeys(const char *path, const int *header, int hlen, const int *keys, long n) {
+  size_t len = strlen(path);
+  char *tmp = (char *)malloc(len + 5);
+  if (tmp == NULL) {
+    return -1;
+  }
+  memcpy(tmp, path, len);
+  strcpy(tmp + len, ".tmp");
+
+  int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    free(tmp);
+    return -1;
+  }
+
+  int status = pwriteAll(fd, header, hlen * sizeof(int), 0);
+  off_t off = hlen * sizeof(int);
+
+  for (long i = 0; status == 0 && i < n; i += SNAPSHOT_CHUNK) {
+    long chunk = n - i < SNAPSHOT_CHUNK ? n - i : SNAPSHOT_CHUNK;
+    status = pwriteAll(fd, keys + i, chunk * sizeof(int), off);
+    off += chunk * sizeof(int);
+  }
+
+  if (status == 0) {
+    status = fsync(fd);
+  }
+  if (close(fd) != 0) {
+    status = -1;
+  }
+  if (status == 0) {
+    status = rename(tmp, path);
+  } else {
+    unlink(tmp);
+  }
+  free(tmp);
+  return status == 0 ? 0 : -1;
+}
+
+/* Reads the file 'path', which must start with the word 'magic' followed by
+ * 'ncounts' non-negative counts (stored in 'counts') and then as many keys as
+ * the counts add up to. Returns a malloc'd array of those keys, or NULL if
+ * the file could not be read or has the wrong format.
+ */
+int *readKeys(const char *path, int magic, int *counts, int ncounts) {
+  FILE *f = fopen(path, "rb");
+  if (f == NULL) {
+    return NULL;
+  }
+
+  int word;
+  long n = 0;
+  if (fread(&word, sizeof(int), 1, f) != 1 || word != magic ||
+      fread(counts, sizeof(int), ncounts, f) != (size_t)ncounts) {
+    fclose(f);
+    return NULL;
+  }
+  for (int i = 0; i < ncounts; i++) {
+    if (counts[i] < 0) {
+      fclose(f);
+      return NULL;
+    }
+    n += counts[i];
+  }
+
+  int *keys = (int *)malloc((n > 0 ? n : 1) * sizeof(int));
+  if (keys == NULL || fread(keys, sizeof(int), n, f) != (size_t)n) {
+    free(keys);
+    keys = NULL;
+  }
+  fclose(f);
+  return keys;
+}
+
+/* Stores in 'out' the sorted keys of 'base' (of length 'nb') with the keys
+ * of 'del' (length 'nd') removed and the keys of 'ins' (length 'ni') added,
+ * all three arrays being sorted. 'ins' and 'del' are disjoint, as recorded
+ * by deltaInsert() and deltaDelete(). 'out' must have room for nb + ni keys.
+ * Returns the number of keys stored.
+ */
+long mergeKeys(const int *base, long nb, const int *ins, long ni,
+               const int *del, long nd, int *out) {
+  long b = 0, i = 0, d = 0, n = 0;
+
+  while (b < nb || i < ni) {
+    int key;
+    if (i == ni || (b < nb && base[b] < ins[i])) {
+      key = base[b++];
+    } else if (b == nb || ins[i] < base[b]) {
+      key = ins[i++];
+    } else {  // in both: keep one copy
+      key = base[b++];
+      i++;
+    }
+
+    while (d < nd && del[d] < key) {
+      d++;
+    }
+    if (d < nd && del[d] == key) {
+      continue;
+    }
+    out[n++] = key;
+  }
+  return n;
+}
+
+/* Returns the number of keys of the tree rooted at 'node' that are not
+ * tombstones.
+ */
+int liveKeys(RAVL_Node *node) { return node == NULL ? 0 : node->live; }
+
+/* Stores the keys of the tree rooted at 'node' that are not tombstones in
+ * 'keys' from index 'i' on, in order. Returns the index after the last.
+ */
+long collectKeys(RAVL_Node *node, int *keys, long i) {
+  if (node == NULL || node->live == 0)
+    return i;
+  i = collectKeys(node->left, keys, i);
+  if (!isDeleted(node)) {
+    keys[i++] = node->key;
+  }
+  return collectKeys(node->right, keys, i);
+}
+
+/* Returns a malloc'd in-order copy of the keys of the tree rooted at
+ * 'node' that are not tombstones, storing their number in 'n'. Returns
+ * NULL (with 'n' set) if memory runs out; an empty tree gives a valid,
+ * non-NULL array.
+ */
+int *copyKeys(RAVL_Node *node, long *n) {
+  *n = liveKeys(node);
+  int *keys = (int *)malloc((*n > 0 ? *n : 1) * sizeof(int));
+  if (keys != NULL) {
+    collectKeys(node, keys, 0);
+  }
+  return keys;
+}
+
+/* Writes the keys buffered in 'w' to its file, counting them in
+ * 'w->written' if it is not NULL.
+ */
+void flushTree(TreeWriter *w) {
+  w->status = pwriteAll(w->fd, w->buf, w->n * sizeof(int), w->off);
+  w->off += w->n * sizeof(int);
+  if (w->written != NULL) {
+    atomic_fetch_add(w->written, w->n);
+  }
+  w->n = 0;
+}
+
+/* Appends the keys of the tree rooted at 'node' that are not tombstones to
+ * the file being written by 'w', in order, one chunk at a time.
+ */
+void writeTree(TreeWriter *w, RAVL_Node *node) {
+  if (node == NULL || node->live == 0 || w->status != 0)
+    return;
+  writeTree(w, node->left);
+  if (!isDeleted(node)) {
+    w->buf[w->n++] = node->key;
+  }
+  if (w->n == SNAPSHOT_CHUNK) {
+    flushTree(w);
+  }
+  writeTree(w, node->right);
+}
+
+/* The body of a forked snapshot: writes the tree rooted at 'node' to 'tmp'
+ * and renames it to 'path', counting the keys written in 'written' if it is
+ * not NULL. Never returns.
+ */
+void snapshotChild(RAVL_Node *node, const char *tmp, const char *path, int *buf,
+                   atomic_long *written) {
+  TreeWriter w = {-1, buf, 0, 2 * sizeof(int), 0, written};
+  int header[2] = {SNAPSHOT_MAGIC, liveKeys(node)};
+
+  w.fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (w.fd < 0) {
+    _exit(1);
+  }
+  w.status = pwriteAll(w.fd, header, sizeof(header), 0);
+  writeTree(&w, node);
+  if (w.status == 0 && w.n > 0) {
+    flushTree(&w);
+  }
+  if (w.status == 0) {
+    w.status = fsync(w.fd);
+  }
+  if (close(w.fd) != 0) {
+    w.status = -1;
+  }
+  if (w.status == 0 && rename(tmp, path) == 0) {
+    _exit(0);
+  }
+  unlink(tmp);
+  _exit(1);
+}
+
+/* Forks a child that writes a snapshot of the tree rooted at 'node' to
+ * 'path', as snapshotChild() does. Everything the child needs is allocated
+ * before the fork. Returns the child's process id, or -1.
+ */
+pid_t forkSnapshot(RAVL_Node *node, const char *path, atomic_long *written) {
+  size_t len = strlen(path);
+  char *tmp = (char *)malloc(len + 5);
+  int *buf = (int *)malloc(SNAPSHOT_CHUNK * sizeof(int));
+  pid_t pid = -1;
+
+  if (tmp != NULL && buf != NULL) {
+    memcpy(tmp, path, len);
+    strcpy(tmp + len, ".tmp");
+    pid = fork();
+    if (pid == 0) {
+      snapshotChild(node, tmp, path, buf, written);
+    }
+  }
+  free(tmp);
+  free(buf);
+  return pid;
+}
+
+/*************************************************************************
+ ** Snapshot functions
+ *************************************************************************/
+
+int writeSnapshot(RAVL_Node *node, const char *path) {
+  long n;
+  int *keys = copyKeys(node, &n);
+  if (keys == NULL) {
+    return -1;
+  }
+  int header[2] = {SNAPSHOT_MAGIC, (int)n};
+  int status = writeKeys(path, header, 2, keys, n);
+  free(keys);
+  return status;
+}
+
+RAVL_Node *loadSnapshot(const char *path, int *ok) {
+  int n;
+  int *keys = readKeys(path, SNAPSHOT_MAGIC, &n, 1);
+  *ok = 0;
+  if (keys == NULL) {
+    return NULL;
+  }
+
+  RAVL_Node *root = buildTree(keys, NULL, n);
+  free(keys);
+  *ok = (n == 0 || root != NULL);
+  return root;
+}
+
+RAVL_SnapshotJob *snapshotStart(RAVL_Node *node, const char *path) {
+  RAVL_SnapshotJob *job = (RAVL_SnapshotJob *)malloc(sizeof(RAVL_SnapshotJob));
+  if (job == NULL) {
+    return NULL;
+  }
+
+  job->n = liveKeys(node);
+  job->written = (atomic_long *)mmap(NULL, sizeof(atomic_long), PROT_READ | PROT_WRITE,
+                                     MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (job->written == MAP_FAILED) {
+    free(job);
+    return NULL;
+  }
+  atomic_init(job->written, 0);
+
+  job->pid = forkSnapshot(node, path, job->written);
+  if (job->pid < 0) {
+    munmap(job->written, sizeof(atomic_long));
+    free(job);
+    return NULL;
+  }
+  return job;
+}
+
+long snapshotProgress(RAVL_SnapshotJob *job, long *total) {
+  if (total != NULL) {
+    *total = job->n;
+  }
+  return atomic_load(job->written);
+}
+
+int snapshotWait(RAVL_SnapshotJob *job) {
+  int status = snapshotForkWait(job->pid, 1);
+  munmap(job->written, sizeof(atomic_long));
+  free(job);
+  return status;
+}
+
+pid_t snapshotFork(RAVL_Node *node, const char *path) {
+  return forkSnapshot(node, path, NULL);
+}
+
+int snapshotForkWait(pid_t pid, int block) {
+  int status;
+  pid_t done;
+
+  do {
+    done = waitpid(pid, &status, block ? 0 : WNOHANG);
+  } while (done < 0 && errno == EINTR);
+
+  if (done == 0) {
+    return 1;
+  }
+  if (done < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+    return -1;
+  }
+  return 0;
+}
+
+/*************************************************************************
+ ** Delta functions
+ *************************************************************************/
+
+RAVL_Node *deltaInsert(RAVL_Delta *delta, RAVL_Node *node, int key, void *value) {
+  int before = liveKeys(node);
+  node = insert(node, key, value);
+  if (liveKeys(node) == before) {  // already live, or out of memory
+    return node;
+  }
+
+  if (search(delta->deleted, key) != NULL) {
+    delta->deleted = delete(delta->deleted, key);
+  } else {
+    delta->inserted = insert(delta->inserted, key, NULL);
+  }
+  return node;
+}
+
+RAVL_Node *deltaDelete(RAVL_Delta *delta, RAVL_Node *node, int key) {
+  int before = liveKeys(node);
+  node = delete(node, key);
+  if (liveKeys(node) == before) {  // absent, or only a tombstone
+    return node;
+  }
+
+  if (search(delta->inserted, key) != NULL) {
+    delta->inserted = delete(delta->inserted, key);
+  } else {
+    delta->deleted = insert(delta->deleted, key, NULL);
+  }
+  return node;
+}
+
+int writeDelta(RAVL_Delta *delta, const char *path) {
+  int ni = delta->inserted == NULL ? 0 : delta->inserted->size;
+  int nd = delta->deleted == NULL ? 0 : delta->deleted->size;
+  int *keys = (int *)malloc((ni + nd > 0 ? ni + nd : 1) * sizeof(int));
+  if (keys == NULL) {
+    return -1;
+  }
+  flattenTree(delta->inserted, keys, NULL);
+  flattenTree(delta->deleted, keys + ni, NULL);
+
+  int header[3] = {DELTA_MAGIC, ni, nd};
+  int status = writeKeys(path, header, 3, keys, ni + nd);
+  free(keys);
+  if (status == 0) {
+    clearDelta(delta);
+  }
+  return status;
+}
+
+void clearDelta(RAVL_Delta *delta) {
+  deleteTree(delta->inserted);
+  deleteTree(delta->deleted);
+  delta->inserted = NULL;
+  delta->deleted = NULL;
+}
+
+RAVL_Node *applyDelta(RAVL_Node *node, const char *path, int *ok) {
+  int counts[2];
+  int *keys = readKeys(path, DELTA_MAGIC, counts, 2);
+  *ok = (keys != NULL);
+  if (keys == NULL) {
+    return node;
+  }
+
+  for (int i = 0; i < counts[0]; i++) {
+    node = insert(node, keys[i], NULL);
+  }
+  for (int i = 0; i < counts[1]; i++) {
+    node = delete(node, keys[counts[0] + i]);
+  }
+  free(keys);
+  return node;
+}
+
+int compactSnapshot(const char *base, const char **deltas, int n, const char *out) {
+  int nb;
+  int *keys = readKeys(base, SNAPSHOT_MAGIC, &nb, 1);
+  if (keys == NULL) {
+    return -1;
+  }
+
+  long nkeys = nb;
+  for (int i = 0; i < n; i++) {
+    int counts[2];
+    int *delta = readKeys(deltas[i], DELTA_MAGIC, counts, 2);
+    int *merged = NULL;
+    if (delta != NULL) {
+      merged = (int *)malloc((nkeys + counts[0] > 0 ? nkeys + counts[0] : 1) * sizeof(int));
+    }
+    if (merged == NULL) {
+      free(delta);
+      free(keys);
+      return -1;
+    }
+
+    nkeys = mergeKeys(keys, nkeys, delta, counts[0], delta + counts[0], counts[1], merged);
+    free(delta);
+    free(keys);
+    keys = merged;
+  }
+
+  int header[2] = {SNAPSHOT_MAGIC, (int)nkeys};
+  int status = writeKeys(out, header, 2, keys, nkeys);
+  free(keys);
+  return status;
+}
@@ -0,0 +1,120 @@
+/*
+ *  Header file for saving RAVL trees to disk and loading them back.
+ *
+ *  A snapshot file holds the keys of a tree in increasing order: a
+ *  SNAPSHOT_MAGIC word, the number of keys, and then the keys themselves,
+ *  all as 32-bit integers in host byte order. Values are pointers and are
+ *  not saved; a loaded tree has NULL values. Tombstones (see markDeleted())
+ *  are left out, so snapshots and deltas follow the tree's live keys.
+ *
+ *  A delta file records the changes made to a tree since the previous
+ *  snapshot or delta: a DELTA_MAGIC word, the number of inserted keys, the
+ *  number of deleted keys, the inserted keys and then the deleted keys, each
+ *  list in increasing order.
+*/
+
+#include <sys/types.h>
+
+#include "RAVL_tree.h"
+
+#ifndef __RAVL_snapshot_header
+#define __RAVL_snapshot_header
+
+#define SNAPSHOT_MAGIC 0x4c564152  // "RAVL" in little-endian byte order
+#define DELTA_MAGIC 0x44564152     // "RAVD" in little-endian byte order
+#define SNAPSHOT_CHUNK 65536       // keys written per pwrite() call
+
+typedef struct snapshot_job RAVL_SnapshotJob;
+
+typedef struct ravl_delta {
+  RAVL_Node* inserted;  // keys inserted since the last snapshot or delta
+  RAVL_Node* deleted;   // keys deleted since the last snapshot or delta
+} RAVL_Delta;
+
+/* Writes a snapshot of the RAVL tree rooted at 'node' to the file 'path'.
+ * The file is replaced atomically: it is written under a temporary name and
+ * renamed into place once complete. Returns 0 on success, -1 on failure.
+*/
+int writeSnapshot(RAVL_Node* node, const char* path);
+
+/* Returns the root of a new RAVL tree holding the keys stored in the
+ * snapshot file 'path'. Stores 0 in 'ok' if the file could not be read or
+ * is not a snapshot, and 1 otherwise (an empty snapshot loads as NULL).
+*/
+RAVL_Node* loadSnapshot(const char* path, int* ok);
+
+/* Starts writing a snapshot of the RAVL tree rooted at 'node' to the file
+ * 'path' in the background, from a child process forked as snapshotFork()
+ * does. The caller may keep inserting into and deleting from the tree while
+ * the snapshot is written; the file reflects the tree as it was at the time
+ * of the call. No keys are copied, so this function returns as soon as the
+ * fork does. Unlike snapshotFork(), the job reports its progress. The job
+ * must be collected with snapshotWait(). Returns NULL if the job could not
+ * be started.
+*/
+RAVL_SnapshotJob* snapshotStart(RAVL_Node* node, const char* path);
+
+/* Returns how many of the snapshot's keys have been written so far, and
+ * stores the total number of keys in 'total' if it is not NULL.
+*/
+long snapshotProgress(RAVL_SnapshotJob* job, long* total);
+
+/* Waits for the snapshot job 'job' to finish and frees it. Returns 0 if the
+ * snapshot was written successfully, -1 otherwise.
+*/
+int snapshotWait(RAVL_SnapshotJob* job);
+
+/* Starts writing a snapshot of the RAVL tree rooted at 'node' to the file
+ * 'path' from a forked child process. The child sees the tree as it was at
+ * the time of the call (the kernel copies pages on write), so the caller may
+ * keep changing the tree, and no copy of the keys is made up front. Returns
+ * the child's process id, or -1 if it could not be started.
+*/
+pid_t snapshotFork(RAVL_Node* node, const char* path);
+
+/* Collects the result of the snapshot started by snapshotFork() in process
+ * 'pid'. If 'block' is nonzero, waits for it to finish; otherwise returns 1
+ * if it is still running. Returns 0 if the snapshot was written successfully
+ * and -1 otherwise.
+*/
+int snapshotForkWait(pid_t pid, int block);
+
+/* Inserts 'key'/'value' into the RAVL tree rooted at 'node', as insert()
+ * does, and records the insertion in 'delta' if 'key' was not already a
+ * live key of the tree (it was absent or a tombstone). Returns the root of
+ * the resulting tree.
+*/
+RAVL_Node* deltaInsert(RAVL_Delta* delta, RAVL_Node* node, int key, void* value);
+
+/* Deletes 'key' from the RAVL tree rooted at 'node', as delete() does, and
+ * records the deletion in 'delta' if 'key' was a live key of the tree (not
+ * a tombstone). Returns the root of the resulting tree.
+*/
+RAVL_Node* deltaDelete(RAVL_Delta* delta, RAVL_Node* node, int key);
+
+/* Writes the changes recorded in 'delta' to the file 'path' (replaced
+ * atomically, as with writeSnapshot()) and, on success, clears 'delta' so
+ * that it records the changes made after this call. Returns 0 on success,
+ * -1 on failure (in which case 'delta' is unchanged).
+*/
+int writeDelta(RAVL_Delta* delta, const char* path);
+
+/* Frees the changes recorded in 'delta', leaving it empty.
+*/
+void clearDelta(RAVL_Delta* delta);
+
+/* Applies the changes stored in the delta file 'path' to the RAVL tree
+ * rooted at 'node'. Stores 0 in 'ok' if the file could not be read or is
+ * not a delta (the tree is then unchanged), and 1 otherwise. Returns the
+ * root of the resulting tree.
+*/
+RAVL_Node* applyDelta(RAVL_Node* node, const char* path, int* ok);
+
+/* Folds the 'n' delta files 'deltas' (oldest first) into the snapshot file
+ * 'base' and writes the result as a new snapshot to 'out', which may be the
+ * same file as 'base'. Runs in time linear in the size of the files; no
+ * tree is built. Returns 0 on success, -1 on failure.
+*/
+int compactSnapshot(const char* base, const char** deltas, int n, const char* out);
+
+#endif
@@ -0,0 +1,197 @@
+/*
+ *  Checks RAVL tree snapshots and measures how much they slow down writers.
+ *
+ *  Usage: RAVL_snapshot_tester [keys [directory]]
+ *
+ *  Builds a tree of 'keys' keys (default 1000000) and checks that a
+ *  snapshot written by writeSnapshot(), snapshotStart() and snapshotFork()
+ *  loads back as the tree was when the snapshot started, even though the
+ *  tree keeps changing meanwhile. Then it times every insert and delete
+ *  made while idle, while a snapshotStart() job is running and while a
+ *  snapshotFork() child is running, and prints the latency percentiles of
+ *  each phase along with how long the starting call itself blocked. Runs
+ *  once with malloc'd nodes and once with nodes from a pool, whose chunks
+ *  keep the pages that copy-on-write has to duplicate few and dense.
+ *  Snapshot files go to 'directory' (default /tmp). The changes are random
+ *  (see RAVL_TEST_SEED). Exits with status 1 on the first failure.
+ *
+ *  Build: gcc -O2 RAVL_snapshot_tester.c RAVL_snapshot.c RAVL_pool.c
+ *         RAVL_tree.c
+ */
+#define _GNU_SOURCE
+#include <string.h>
+#include <unistd.h>
+
+#include "RAVL_pool.h"
+#include "RAVL_snapshot.h"
+#include "RAVL_test.h"
+
+#define PHASE_OPS 200000  // timed operations while idle
+#define MIN_OPS 1000      // timed operations at least, even if the snapshot ends
+
+typedef struct latencies {
+  double* us;  // latency of each operation, in microseconds
+  long n;
+  long cap;
+} Latencies;
+
+RAVL_Node* root;
+int keys;
+unsigned seed;
+char path[4096];
+
+void runAll(const char* label);
+void checkSnapshots(void);
+void measure(void);
+
+int main(int argc, char* argv[]) {
+  seed = testSeed();
+  keys = argc > 1 ? atoi(argv[1]) : 1000000;
+  snprintf(path, sizeof(path), "%s/ravl_snapshot_tester.%d", argc > 2 ? argv[2] : "/tmp",
+           (int)getpid());
+
+  runAll("malloc'd nodes");
+
+  RAVL_Pool* pool = poolCreate(0, POOL_ANY);
+  CHECK(pool != NULL);
+  setAllocator(poolAllocator(pool));
+  runAll("pooled nodes");
+  setAllocator(NULL);
+  poolDestroy(pool);
+
+  unlink(path);
+  printf("ok\n");
+  return 0;
+}
+
+/* Makes one random change to the tree, of the kind a busy writer makes. */
+void change(void) {
+  unsigned r = testRandom(&seed);
+  int key = (int)(r % (2u * keys));
+  if (r >> 23) {
+    root = insert(root, key, NULL);
+  } else {
+    root = delete(root, key);
+  }
+}
+
+/* Times one change, recording it in 'l'. */
+void timedChange(Latencies* l) {
+  double start = testNow();
+  change();
+  if (l->n == l->cap) {
+    l->cap = l->cap == 0 ? 4096 : 2 * l->cap;
+    l->us = (double*)realloc(l->us, l->cap * sizeof(double));
+    CHECK(l->us != NULL);
+  }
+  l->us[l->n++] = (testNow() - start) * 1e6;
+}
+
+int compareDoubles(const void* a, const void* b) {
+  double x = *(const double*)a, y = *(const double*)b;
+  return (x > y) - (x < y);
+}
+
+void report(const char* phase, Latencies* l, double blocked) {
+  qsort(l->us, l->n, sizeof(double), compareDoubles);
+  printf("  %-14s %8ld ops  p50 %6.2f us  p99 %7.2f us  p99.9 %8.2f us  max %9.1f us",
+         phase, l->n, l->us[l->n / 2], l->us[l->n * 99 / 100], l->us[l->n * 999 / 1000],
+         l->us[l->n - 1]);
+  if (blocked >= 0) {
+    printf("  start blocked %.1f ms", blocked / 1e3);
+  }
+  printf("\n");
+  free(l->us);
+  *l = (Latencies){NULL, 0, 0};
+}
+
+void runAll(const char* label) {
+  root = NULL;
+  for (int i = 0; i < keys; i++) {
+    root = insert(root, 2 * i, NULL);
+  }
+  printf("%s, %d keys:\n", label, keys);
+  checkSnapshots();
+  measure();
+  deleteTree(root);
+}
+
+/* Checks that the snapshot at 'path' holds exactly the 'n' keys 'expect'. */
+void checkFile(const int* expect, int n) {
+  int ok;
+  RAVL_Node* loaded = loadSnapshot(path, &ok);
+  CHECK(ok);
+  CHECK((loaded == NULL ? 0 : loaded->size) == n);
+  int* got = (int*)malloc((n > 0 ? n : 1) * sizeof(int));
+  CHECK(got != NULL);
+  flattenTree(loaded, got, NULL);
+  CHECK(memcmp(got, expect, n * sizeof(int)) == 0);
+  free(got);
+  deleteTree(loaded);
+}
+
+void checkSnapshots(void) {
+  int n = root == NULL ? 0 : root->size;
+  int* expect = (int*)malloc((n > 0 ? n : 1) * sizeof(int));
+  CHECK(expect != NULL);
+  flattenTree(root, expect, NULL);
+
+  CHECK(writeSnapshot(root, path) == 0);
+  checkFile(expect, n);
+
+  RAVL_SnapshotJob* job = snapshotStart(root, path);
+  CHECK(job != NULL);
+  for (int i = 0; i < 10000; i++) {
+    change();
+  }
+  CHECK(snapshotWait(job) == 0);
+  checkFile(expect, n);
+
+  n = root == NULL ? 0 : root->size;
+  expect = (int*)realloc(expect, (n > 0 ? n : 1) * sizeof(int));
+  CHECK(expect != NULL);
+  flattenTree(root, expect, NULL);
+  pid_t pid = snapshotFork(root, path);
+  CHECK(pid > 0);
+  for (int i = 0; i < 10000; i++) {
+    change();
+  }
+  CHECK(snapshotForkWait(pid, 1) == 0);
+  checkFile(expect, n);
+  free(expect);
+}
+
+void measure(void) {
+  Latencies l = {NULL, 0, 0};
+
+  for (long i = 0; i < PHASE_OPS; i++) {
+    timedChange(&l);
+  }
+  report("idle", &l, -1);
+
+  double start = testNow();
+  RAVL_SnapshotJob* job = snapshotStart(root, path);
+  double blocked = (testNow() - start) * 1e6;
+  CHECK(job != NULL);
+  long total, written;
+  do {
+    timedChange(&l);
+    written = snapshotProgress(job, &total);
+  } while (written < total || l.n < MIN_OPS);
+  CHECK(snapshotWait(job) == 0);
+  report("snapshotStart", &l, blocked);
+
+  start = testNow();
+  pid_t pid = snapshotFork(root, path);
+  blocked = (testNow() - start) * 1e6;
+  CHECK(pid > 0);
+  int status = 1;
+  do {
+    timedChange(&l);
+    if (status == 1 && l.n % 64 == 0) {
+      status = snapshotForkWait(pid, 0);
+    }
+  } while (status == 1 || l.n < MIN_OPS);
+  CHECK(status == 0);
+  report("snapshotFork", &l, blocked);
+}
@@ -0,0 +1,58 @@
+/*
+ *  Header file for helpers shared by the standalone RAVL_*_tester programs.
+ *
+ *  Testers draw their pseudo-random numbers with testRandom() from seeds
+ *  derived from testSeed(), which reads the RAVL_TEST_SEED environment
+ *  variable (1 if it is not set). A failed CHECK() prints the seed, so the
+ *  run can be repeated, and other seeds can be tried without rebuilding.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#ifndef __RAVL_test_header
+#define __RAVL_test_header
+
+static unsigned test_seed = 1;  // set by testSeed()
+
+/* Exits with status 1, naming the condition, the source line and the seed,
+ * unless 'cond' holds.
+*/
+#define CHECK(cond)                                                          \
+  do {                                                                       \
+    if (!(cond)) {                                                           \
+      fprintf(stderr, "%s:%d: check failed: %s (RAVL_TEST_SEED=%u)\n",       \
+              __FILE__, __LINE__, #cond, test_seed);                         \
+      exit(1);                                                               \
+    }                                                                        \
+  } while (0)
+
+/* Reads the seed of this run from RAVL_TEST_SEED and returns it. Call it
+ * first thing in main().
+*/
+static inline unsigned testSeed(void) {
+  const char* s = getenv("RAVL_TEST_SEED");
+  if (s != NULL && *s != '\0') {
+    test_seed = (unsigned)strtoul(s, NULL, 0);
+  }
+  return test_seed;
+}
+
+/* Advances 'seed' and returns the next pseudo-random number from it, in
+ * 0 .. 2^24 - 1.
+*/
+static inline unsigned testRandom(unsigned* seed) {
+  *seed = *seed * 1103515245 + 12345;
+  return *seed >> 8;
+}
+
+/* Returns the current time of the monotonic clock in seconds.
+*/
+static inline double testNow(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+#endif
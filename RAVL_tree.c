@@ -4,8 +4,27 @@
  *  Based on materials developed by F. Estrada.
  */
 
+#include <limits.h>
+#include <stdint.h>
+
 #include "RAVL_tree.h"
 
+// where nodes come from; NULL means malloc() and free()
+static RAVL_Allocator *allocator = NULL;
+
+// the value of a tombstone; no caller can hold this address
+static char tombstone;
+#define TOMBSTONE ((void *)&tombstone)
+
+struct ravl_tree {
+  RAVL_Node *root;
+  RAVL_Allocator *allocator;  // where this tree's nodes come from
+  double lazy;                // tombstone fraction that triggers a purge, or 0
+  RAVL_Node *min;             // node with the smallest key, NULL if empty
+  RAVL_Node *max;             // node with the largest key, NULL if empty
+  RAVL_TreeStats stats;
+};
+
 /*************************************************************************
  ** Suggested helper functions
  *************************************************************************/
@@ -32,6 +51,16 @@ int size(RAVL_Node *node) {
   return node->size;
 }
 
+/* Returns the number of nodes of the tree rooted at 'node' that are not
+ * tombstones. Returns 0 if 'node' is NULL.
+ */
+int live(RAVL_Node *node) {
+  if (node == NULL) {
+    return 0;
+  }
+  return node->live;
+}
+
 /* Updates the height of the tree rooted at node 'node' based on the heights
  * of its children. Note: this should be an O(1) operation.
  */
@@ -69,14 +98,18 @@ void updateSize(RAVL_Node *node) {
 
   int left_size = 0;
   int right_size = 0;
+  int live = node->value != TOMBSTONE;
 
   if (node->right != NULL) {
     right_size = node->right->size;
+    live += node->right->live;
   }
   if (node->left != NULL) {
     left_size = node->left->size;
+    live += node->left->live;
   }
   node->size = left_size + right_size + 1;
+  node->live = live;
 }
 
 /* Returns the balance factor (height of left subtree - height of right
@@ -104,11 +137,22 @@ int balanceFactor(RAVL_Node *node) {
   return (left_height - right_height);
 }
 
+/* Updates the height and size of node 'node', then calls 'augment' on it
+ * unless it is NULL.
+ */
+void refresh(RAVL_Node *node, RAVL_Augment augment) {
+  updateHeight(node);
+  updateSize(node);
+  if (augment != NULL) {
+    augment(node);
+  }
+}
+
 /* Returns the result of performing the corresponding rotation in the RAVL
- * tree rooted at 'node'.
+ * tree rooted at 'node', calling 'augment' as refresh() does.
  */
 // single rotations: right/clockwise
-RAVL_Node *rightRotation(RAVL_Node *node) {
+RAVL_Node *rightRotation_(RAVL_Node *node, RAVL_Augment augment) {
   // if left child is null
   if (node == NULL || node->left == NULL) {
     return node;
@@ -121,16 +165,14 @@ RAVL_Node *rightRotation(RAVL_Node *node) {
   new_head->right = node;
   node->left = shift;
 
-  updateHeight(node);
-  updateSize(node);
-  updateHeight(new_head);
-  updateSize(new_head);
+  refresh(node, augment);
+  refresh(new_head, augment);
 
   return new_head;
 }
 
 // single rotations: left/counter-clockwise
-RAVL_Node *leftRotation(RAVL_Node *node) {
+RAVL_Node *leftRotation_(RAVL_Node *node, RAVL_Augment augment) {
 
   if (node == NULL || node->right == NULL) {
     return node;
@@ -142,32 +184,96 @@ RAVL_Node *leftRotation(RAVL_Node *node) {
   new_head->left = node;
   node->right = shift;
 
-  updateHeight(node);
-  updateSize(node);
-  updateHeight(new_head);
-  updateSize(new_head);
+  refresh(node, augment);
+  refresh(new_head, augment);
 
   return new_head;
 }
+
+RAVL_Node *rightRotation(RAVL_Node *node) { return rightRotation_(node, NULL); }
+
+RAVL_Node *leftRotation(RAVL_Node *node) { return leftRotation_(node, NULL); }
+
 // double rotation: right/clockwise then left/counter-clockwise
-RAVL_Node *rightLeftRotation(RAVL_Node *node) {
+RAVL_Node *rightLeftRotation(RAVL_Node *node, RAVL_Augment augment) {
   if (node == NULL || node->right == NULL) {
     return node;
   }
 
-  node->right = rightRotation(node->right);
+  node->right = rightRotation_(node->right, augment);
 
-  return leftRotation(node);
+  return leftRotation_(node, augment);
 }
 // double rotation: left/counter-clockwise then right/clockwise
-RAVL_Node *leftRightRotation(RAVL_Node *node) {
+RAVL_Node *leftRightRotation(RAVL_Node *node, RAVL_Augment augment) {
   if (node == NULL || node->left == NULL) {
     return node;
   }
 
-  node->left = leftRotation(node->left);
+  node->left = leftRotation_(node->left, augment);
 
-  return rightRotation(node);
+  return rightRotation_(node, augment);
+}
+
+/* Updates the height and size of node 'node' and, if it is out of balance
+ * by 2, performs the rotation that restores the balance, calling 'augment'
+ * (unless it is NULL) on every node whose children change. Returns the root
+ * of the resulting subtree.
+ */
+RAVL_Node *rebalance_(RAVL_Node *node, RAVL_Augment augment) {
+  if (node == NULL) {
+    return NULL;
+  }
+  refresh(node, augment);
+
+  int balance = balanceFactor(node);
+  if (balance > 1) {
+    if (balanceFactor(node->left) >= 0) {
+      return rightRotation_(node, augment);
+    }
+    return leftRightRotation(node, augment);
+  }
+  if (balance < -1) {
+    if (balanceFactor(node->right) <= 0) {
+      return leftRotation_(node, augment);
+    }
+    return rightLeftRotation(node, augment);
+  }
+  return node;
+}
+
+RAVL_Node *rebalance(RAVL_Node *node) { return rebalance_(node, NULL); }
+
+/* Detaches the node with the smallest key from the tree rooted at 'node',
+ * storing it in 'min'. Returns the root of the remaining tree.
+ */
+RAVL_Node *detachMin(RAVL_Node *node, RAVL_Node **min) {
+  if (node->left == NULL) {
+    *min = node;
+    RAVL_Node *rest = node->right;
+    node->right = NULL;
+    updateHeight(node);
+    updateSize(node);
+    return rest;
+  }
+  node->left = detachMin(node->left, min);
+  return rebalance(node);
+}
+
+/* Detaches the node with the largest key from the tree rooted at 'node',
+ * storing it in 'max'. Returns the root of the remaining tree.
+ */
+RAVL_Node *detachMax(RAVL_Node *node, RAVL_Node **max) {
+  if (node->right == NULL) {
+    *max = node;
+    RAVL_Node *rest = node->left;
+    node->left = NULL;
+    updateHeight(node);
+    updateSize(node);
+    return rest;
+  }
+  node->right = detachMax(node->right, max);
+  return rebalance(node);
 }
 
 /* Returns the successor node of 'node'. */
@@ -189,10 +295,16 @@ RAVL_Node *successor(RAVL_Node *node) {
 }
 
 /* Creates and returns an RAVL tree node with key 'key', value 'value', height
- * and size of 1, and left and right subtrees NULL.
+ * and size of 1, and left and right subtrees NULL, taking its memory from
+ * allocator 'from' (malloc() if it is NULL).
  */
-RAVL_Node *createNode(int key, void *value) {
-  RAVL_Node *new_node = (RAVL_Node *)malloc(sizeof(RAVL_Node));
+RAVL_Node *createNode(RAVL_Allocator *from, int key, void *value) {
+  RAVL_Node *new_node;
+  if (from == NULL) {
+    new_node = (RAVL_Node *)malloc(sizeof(RAVL_Node));
+  } else {
+    new_node = (RAVL_Node *)from->alloc(from->ctx);
+  }
   if (new_node == NULL) {
     return NULL;
   }
@@ -201,12 +313,22 @@ RAVL_Node *createNode(int key, void *value) {
   new_node->value = value;
   new_node->height = 1;
   new_node->size = 1;
+  new_node->live = 1;
   new_node->left = NULL;
   new_node->right = NULL;
 
   return new_node;
 }
 
+/* Returns node 'node' to allocator 'from', which createNode() got it from. */
+void freeNode(RAVL_Allocator *from, RAVL_Node *node) {
+  if (from == NULL) {
+    free(node);
+  } else {
+    from->release(from->ctx, node);
+  }
+}
+
 /*************************************************************************
  ** Provided functions
  *************************************************************************/
@@ -221,12 +343,57 @@ void printTreeInorder_(RAVL_Node *node, int offset) {
 
 void printTreeInorder(RAVL_Node *node) { printTreeInorder_(node, 0); }
 
-void deleteTree(RAVL_Node *node) {
+void deleteTree_(RAVL_Allocator *from, RAVL_Node *node) {
   if (node == NULL)
     return;
-  deleteTree(node->left);
-  deleteTree(node->right);
-  free(node);
+  deleteTree_(from, node->left);
+  deleteTree_(from, node->right);
+  freeNode(from, node);
+}
+
+void deleteTree(RAVL_Node *node) { deleteTree_(allocator, node); }
+
+int flattenTree_(RAVL_Node *node, int *keys, void **values, int i) {
+  if (node == NULL)
+    return i;
+  i = flattenTree_(node->left, keys, values, i);
+  keys[i] = node->key;
+  if (values != NULL) {
+    values[i] = node->value;
+  }
+  return flattenTree_(node->right, keys, values, i + 1);
+}
+
+int flattenTree(RAVL_Node *node, int *keys, void **values) {
+  return flattenTree_(node, keys, values, 0);
+}
+
+RAVL_Node *buildTree(const int *keys, void **values, int n) {
+  if (n <= 0) {
+    return NULL;
+  }
+
+  int mid = n / 2;
+  RAVL_Node *node = createNode(allocator, keys[mid], values == NULL ? NULL : values[mid]);
+  if (node == NULL) {
+    return NULL;
+  }
+  node->left = buildTree(keys, values, mid);
+  node->right = buildTree(keys + mid + 1,
+                          values == NULL ? NULL : values + mid + 1, n - mid - 1);
+  if ((mid > 0 && node->left == NULL) || (n - mid - 1 > 0 && node->right == NULL)) {
+    deleteTree(node);
+    return NULL;
+  }
+  updateHeight(node);
+  updateSize(node);
+  return node;
+}
+
+void setAllocator(RAVL_Allocator *new_allocator) { allocator = new_allocator; }
+
+RAVL_Node *rebalanceAugmented(RAVL_Node *node, RAVL_Augment augment) {
+  return rebalance_(node, augment);
 }
 
 /*************************************************************************
@@ -247,56 +414,182 @@ RAVL_Node *search(RAVL_Node *node, int key) {
   }
 }
 
+/* Does the work of insert(), upsert() and getOrInsert(): finds 'key' in the
+ * tree rooted at 'node', inserting it if it is missing with 'value' (or, if
+ * 'factory' is not NULL, the value factory(key, ctx) returns), and
+ * replacing the value of an existing node with 'value' if 'replace'.
+ * Stores the node in 'found' (NULL if memory runs out) and whether the key
+ * was there in 'existed'. New nodes come from allocator 'from'.
+ */
+RAVL_Node *insert_(RAVL_Allocator *from, RAVL_Node *node, int key, void *value,
+                   void *(*factory)(int, void *), void *ctx, int replace, RAVL_Node **found,
+                   int *existed) {
+  if (node == NULL) {
+    *existed = 0;
+    *found = createNode(from, key, factory == NULL ? value : NULL);
+    if (*found != NULL && factory != NULL) {
+      (*found)->value = factory(key, ctx);
+    }
+    return *found;
+  }
+
+  if (key < node->key) {
+    node->left = insert_(from, node->left, key, value, factory, ctx, replace, found, existed);
+  } else if (key > node->key) {
+    node->right = insert_(from, node->right, key, value, factory, ctx, replace, found, existed);
+  } else {
+    *found = node;
+    *existed = node->value != TOMBSTONE;
+    if (!*existed) {  // bring the tombstone back to life
+      node->value = factory == NULL ? value : factory(key, ctx);
+      updateSize(node);
+    } else if (replace) {
+      node->value = value;
+    }
+    return node;
+  }
+  if (*existed || *found == NULL) {
+    return node;  // nothing below changed
+  }
+  return rebalance(node);
+}
+
 RAVL_Node *insert(RAVL_Node *node, int key, void *value) {
+  RAVL_Node *found;
+  int existed;
+  return insert_(allocator, node, key, value, NULL, NULL, 1, &found, &existed);
+}
+
+RAVL_Node *upsert(RAVL_Node *node, int key, void *value, RAVL_Node **found, int *existed) {
+  RAVL_Node *f;
+  int e;
+  node = insert_(allocator, node, key, value, NULL, NULL, 1, &f, &e);
+  if (found != NULL) {
+    *found = f;
+  }
+  if (existed != NULL) {
+    *existed = e;
+  }
+  return node;
+}
+
+RAVL_Node *getOrInsert(RAVL_Node *node, int key, void *(*factory)(int key, void *ctx),
+                       void *ctx, RAVL_Node **found) {
+  RAVL_Node *f;
+  int e;
+  node = insert_(allocator, node, key, NULL, factory, ctx, 0, &f, &e);
+  if (found != NULL) {
+    *found = f;
+  }
+  return node;
+}
 
+/* Does the work of insertWithRank(), adding to 'greater' the number of live
+ * keys larger than 'key' outside the subtrees it descends into.
+ */
+RAVL_Node *insertWithRank_(RAVL_Node *node, int key, void *value, int *greater) {
   if (node == NULL) {
-    return createNode(key, value);
+    return createNode(allocator, key, value);
   }
 
   if (key < node->key) {
-    node->left = insert(node->left, key, value);
+    *greater += live(node->right) + (node->value != TOMBSTONE);
+    node->left = insertWithRank_(node->left, key, value, greater);
   } else if (key > node->key) {
-    node->right = insert(node->right, key, value);
+    node->right = insertWithRank_(node->right, key, value, greater);
   } else {
+    int revived = node->value == TOMBSTONE;
+    *greater += live(node->right);
+    node->value = value;
+    if (revived) {
+      updateSize(node);
+    }
     return node;
   }
-  updateHeight(node);
-  updateSize(node);
+  return rebalance(node);
+}
 
-  // balance
-  int balance = balanceFactor(node);
+RAVL_Node *insertWithRank(RAVL_Node *node, int key, void *value, int *rank) {
+  int greater = 0;
+  RAVL_Node *root = insertWithRank_(node, key, value, &greater);
+  if (rank != NULL) {
+    *rank = greater + 1;
+  }
+  return root;
+}
 
-  // left heavy
-  if (balance > 1) {
-    // left right case
-    if (key > node->left->key) {
-      return leftRightRotation(node);
-    } else {
-      return rightRotation(node);
-    }
+/* Orders (key, index) pairs by key, then by index. */
+int comparePairs(const void *a, const void *b) {
+  const int *p = (const int *)a, *q = (const int *)b;
+  if (p[0] != q[0]) {
+    return p[0] < q[0] ? -1 : 1;
   }
-  // right heavy
-  if (balance < -1) {
-    // right left case
-    if (key < node->right->key) {
-      return rightLeftRotation(node);
-    } else {
-      return leftRotation(node);
+  return p[1] - q[1];
+}
+
+long long countInversions(const int *keys, int n, int *greater) {
+  if (n <= 0) {
+    return 0;
+  }
+
+  // replace the keys by their positions in sorted order, so that equal
+  // keys become distinct without any of them counting as larger than an
+  // earlier one
+  if ((size_t)n > SIZE_MAX / (2 * sizeof(int))) {
+    return -1;
+  }
+  int *pairs = (int *)malloc(2 * (size_t)n * sizeof(int));
+  int *id = (int *)malloc((size_t)n * sizeof(int));
+  if (pairs == NULL || id == NULL) {
+    free(pairs);
+    free(id);
+    return -1;
+  }
+  for (int i = 0; i < n; i++) {
+    pairs[2 * i] = keys[i];
+    pairs[2 * i + 1] = i;
+  }
+  qsort(pairs, n, 2 * sizeof(int), comparePairs);
+  for (int i = 0; i < n; i++) {
+    id[pairs[2 * i + 1]] = i;
+  }
+  free(pairs);
+
+  RAVL_Node *seen = NULL;  // the ids so far
+  long long total = 0;
+  for (int i = 0; i < n; i++) {
+    int r;
+    seen = insertWithRank(seen, id[i], NULL, &r);
+    if (size(seen) != i + 1) {  // out of memory
+      deleteTree(seen);
+      free(id);
+      return -1;
+    }
+    if (greater != NULL) {
+      greater[i] = r - 1;
     }
+    total += r - 1;
   }
-  return node;
+  deleteTree(seen);
+  free(id);
+  return total;
 }
 
-RAVL_Node *delete(RAVL_Node *node, int key) {
+/* Does the work of delete(), storing the deleted key's value in 'value'
+ * and setting 'deleted' if the key was in the tree.
+ */
+RAVL_Node *delete_(RAVL_Allocator *from, RAVL_Node *node, int key, void **value, int *deleted) {
   if (node == NULL) {
     return node;
   }
 
   if (key < node->key) {
-    node->left = delete (node->left, key);
+    node->left = delete_(from, node->left, key, value, deleted);
   } else if (key > node->key) {
-    node->right = delete (node->right, key);
+    node->right = delete_(from, node->right, key, value, deleted);
   } else {
+    *deleted = node->value != TOMBSTONE;
+    *value = *deleted ? node->value : NULL;
     if (node->left == NULL || node->right == NULL) {
       RAVL_Node *temp = NULL;
       if (node->left == NULL && node->right == NULL) {
@@ -307,43 +600,262 @@ RAVL_Node *delete(RAVL_Node *node, int key) {
         temp = node->left;
       }
       if (temp == NULL) { // No children
-        free(node);
+        freeNode(from, node);
         node = NULL;
       } else { // One child
         RAVL_Node *toFree = node;
         node = temp; // Directly use the child as the new node
-        free(toFree);
+        freeNode(from, toFree);
       }
+    } else {  // the successor takes this node's place
+      RAVL_Node *temp;
+      RAVL_Node *right = detachMin(node->right, &temp);
+      temp->left = node->left;
+      temp->right = right;
+      freeNode(from, node);
+      node = temp;
+    }
+  }
+  return rebalance(node);
+}
+
+RAVL_Node *delete(RAVL_Node *node, int key) {
+  void *value;
+  int deleted = 0;
+  return delete_(allocator, node, key, &value, &deleted);
+}
+
+RAVL_Node *deleteAndGet(RAVL_Node *node, int key, void **value, int *deleted) {
+  void *v = NULL;
+  int d = 0;
+  node = delete_(allocator, node, key, &v, &d);
+  if (value != NULL) {
+    *value = v;
+  }
+  if (deleted != NULL) {
+    *deleted = d;
+  }
+  return node;
+}
+
+/* Does the work of deleteRank(), returning the node to allocator 'from'. */
+RAVL_Node *deleteRank_(RAVL_Allocator *from, RAVL_Node *node, int rank, int *key,
+                       void **value) {
+  if (node == NULL) {
+    return NULL;
+  }
+
+  int r = size(node->left) + 1;
+  if (rank < r) {
+    node->left = deleteRank_(from, node->left, rank, key, value);
+  } else if (rank > r) {
+    node->right = deleteRank_(from, node->right, rank - r, key, value);
+  } else {
+    if (key != NULL) {
+      *key = node->key;
+    }
+    if (value != NULL) {
+      *value = node->value == TOMBSTONE ? NULL : node->value;
+    }
+    RAVL_Node *rest;
+    if (node->left == NULL) {
+      rest = node->right;
+    } else if (node->right == NULL) {
+      rest = node->left;
+    } else {  // the successor takes this node's place
+      RAVL_Node *right = detachMin(node->right, &rest);
+      rest->left = node->left;
+      rest->right = right;
+    }
+    freeNode(from, node);
+    return rebalance(rest);
+  }
+  return rebalance(node);
+}
+
+RAVL_Node *deleteRank(RAVL_Node *node, int rank, int *key, void **value) {
+  return deleteRank_(allocator, node, rank, key, value);
+}
+
+/* Does the work of popMin() (if 'min') or popMax() (otherwise), returning
+ * the node to allocator 'from'.
+ */
+RAVL_Node *pop(RAVL_Allocator *from, RAVL_Node *node, int min, int *key, void **value) {
+  if (node == NULL) {
+    return NULL;
+  }
+
+  RAVL_Node *popped;
+  node = min ? detachMin(node, &popped) : detachMax(node, &popped);
+  if (key != NULL) {
+    *key = popped->key;
+  }
+  if (value != NULL) {
+    *value = popped->value == TOMBSTONE ? NULL : popped->value;
+  }
+  freeNode(from, popped);
+  return node;
+}
+
+RAVL_Node *popMin(RAVL_Node *node, int *key, void **value) {
+  return pop(allocator, node, 1, key, value);
+}
+
+RAVL_Node *popMax(RAVL_Node *node, int *key, void **value) {
+  return pop(allocator, node, 0, key, value);
+}
+
+int markDeleted(RAVL_Node *node, int key, void **value) {
+  RAVL_Node *path[MAX_HEIGHT];
+  int depth = 0;
+
+  while (node != NULL) {
+    path[depth++] = node;
+    if (node->key == key) {
+      break;
+    }
+    node = key < node->key ? node->left : node->right;
+  }
+  if (node == NULL || node->value == TOMBSTONE) {
+    return 0;
+  }
+
+  if (value != NULL) {
+    *value = node->value;
+  }
+  node->value = TOMBSTONE;
+  for (int i = 0; i < depth; i++) {
+    path[i]->live--;
+  }
+  return 1;
+}
+
+/* Marks the live node with live rank 'rank' in the tree rooted at 'node'
+ * as a tombstone, in one walk, storing its key in 'key' and its value in
+ * 'value' (each if it is not NULL). 'rank' must be within the tree.
+ */
+void markRank(RAVL_Node *node, int rank, int *key, void **value) {
+  while (1) {
+    int r = live(node->left);
+    int here = node->value != TOMBSTONE;
+    node->live--;  // the node marked is in this subtree
+    if (rank <= r) {
+      node = node->left;
+    } else if (here && rank == r + 1) {
+      break;
+    } else {
+      rank -= r + here;
+      node = node->right;
+    }
+  }
+
+  if (key != NULL) {
+    *key = node->key;
+  }
+  if (value != NULL) {
+    *value = node->value;
+  }
+  node->value = TOMBSTONE;
+}
+
+int isDeleted(RAVL_Node *node) { return node->value == TOMBSTONE; }
+
+RAVL_Node *liveSearch(RAVL_Node *node, int key) {
+  node = search(node, key);
+  return node == NULL || node->value == TOMBSTONE ? NULL : node;
+}
+
+int liveRank(RAVL_Node *node, int key) {
+  int seen = 0;  // live keys known to be smaller than the current subtree
+
+  while (node != NULL && node->key != key) {
+    if (key > node->key) {
+      seen += live(node->left) + (node->value != TOMBSTONE);
+      node = node->right;
+    } else {
+      node = node->left;
+    }
+  }
+  if (node == NULL || node->value == TOMBSTONE) {
+    return NOTIN;
+  }
+  return seen + live(node->left) + 1;
+}
+
+RAVL_Node *liveFindRank(RAVL_Node *node, int rank) {
+  while (node != NULL) {
+    int r = live(node->left);
+    int here = node->value != TOMBSTONE;
+    if (rank <= r) {
+      node = node->left;
+    } else if (here && rank == r + 1) {
+      return node;
     } else {
-      RAVL_Node *temp = successor(node);
-      node->key = temp->key;
-      node->right = delete (node->right, temp->key);
+      rank -= r + here;
+      node = node->right;
     }
   }
+  return NULL;
+}
+
+/* Stores the live nodes of the tree rooted at 'node' in 'nodes' in
+ * in-order, from index 'i' on, returning the tombstones to allocator
+ * 'from'. Returns the index after the last node stored.
+ */
+int collectLive(RAVL_Allocator *from, RAVL_Node *node, RAVL_Node **nodes, int i) {
+  if (node == NULL) {
+    return i;
+  }
+  RAVL_Node *right = node->right;
+  i = collectLive(from, node->left, nodes, i);
+  if (node->value == TOMBSTONE) {
+    freeNode(from, node);
+  } else {
+    nodes[i++] = node;
+  }
+  return collectLive(from, right, nodes, i);
+}
+
+/* Returns the root of a perfectly balanced tree linking the 'n' nodes in
+ * 'nodes', which are in increasing key order.
+ */
+RAVL_Node *linkBalanced(RAVL_Node **nodes, int n) {
+  if (n <= 0) {
+    return NULL;
+  }
+  int mid = n / 2;
+  RAVL_Node *node = nodes[mid];
+  node->left = linkBalanced(nodes, mid);
+  node->right = linkBalanced(nodes + mid + 1, n - mid - 1);
   updateHeight(node);
   updateSize(node);
+  return node;
+}
 
-  int balance = balanceFactor(node);
-
-  // left heavy
-  if (balance > 1 && balanceFactor(node->left) >= 0) {
-    // Right rotation
-    return rightRotation(node);
-  } else if (balance > 1 && balanceFactor(node->left) < 0) {
-    // Left-Right rotation
-    return leftRightRotation(node);
+/* Does the work of purgeDeleted(), returning tombstones to allocator
+ * 'from'.
+ */
+RAVL_Node *purgeDeleted_(RAVL_Allocator *from, RAVL_Node *node) {
+  if (node == NULL || node->live == node->size) {
+    return node;
+  }
+  if (node->live == 0) {
+    deleteTree_(from, node);
+    return NULL;
   }
 
-  if (balance < -1 && balanceFactor(node->right) >= 0) {
-    // Right rotation
-    return leftRotation(node);
-  } else if (balance < -1 && balanceFactor(node->right) < 0) {
-    // Left-Right rotation
-    return rightLeftRotation(node);
+  RAVL_Node **nodes = (RAVL_Node **)malloc(node->live * sizeof(RAVL_Node *));
+  if (nodes == NULL) {
+    return node;
   }
+  int n = collectLive(from, node, nodes, 0);
+  node = linkBalanced(nodes, n);
+  free(nodes);
   return node;
 }
 
+RAVL_Node *purgeDeleted(RAVL_Node *node) { return purgeDeleted_(allocator, node); }
+
 int rank(RAVL_Node *node, int key) {
   if (node == NULL) {
     return NOTIN;
@@ -351,12 +863,34 @@ int rank(RAVL_Node *node, int key) {
   if (node->key == key) {
     return size(node->left) + 1;
   } else if (key > node->key) {
-    return size(node->left) + 1 + rank(node->right, key);
+    int r = rank(node->right, key);
+    if (r == NOTIN) {
+      return NOTIN;
+    }
+    return size(node->left) + 1 + r;
   } else {
     return rank(node->left, key);
   }
 }
 
+RAVL_Node *searchWithRank(RAVL_Node *node, int key, int *rank) {
+  int seen = 0;  // keys known to be smaller than the current subtree
+
+  while (node != NULL && node->key != key) {
+    if (key > node->key) {
+      seen += size(node->left) + 1;
+      node = node->right;
+    } else {
+      node = node->left;
+    }
+  }
+
+  if (rank != NULL) {
+    *rank = node == NULL ? NOTIN : seen + size(node->left) + 1;
+  }
+  return node;
+}
+
 RAVL_Node *findRank(RAVL_Node *node, int rank) {
   // deal with special case
   if (node == NULL) {
@@ -372,3 +906,600 @@ RAVL_Node *findRank(RAVL_Node *node, int rank) {
     return findRank(node->right, rank - r);
   }
 }
+
+int rankDesc(RAVL_Node *node, int key) {
+  int seen = 0;  // keys known to be larger than the current subtree
+
+  while (node != NULL && node->key != key) {
+    if (key < node->key) {
+      seen += size(node->right) + 1;
+      node = node->left;
+    } else {
+      node = node->right;
+    }
+  }
+  return node == NULL ? NOTIN : seen + size(node->right) + 1;
+}
+
+RAVL_Node *findRankDesc(RAVL_Node *node, int rank) {
+  while (node != NULL) {
+    int r = size(node->right) + 1;
+    if (r == rank) {
+      return node;
+    } else if (rank < r) {
+      node = node->right;
+    } else {
+      rank -= r;
+      node = node->left;
+    }
+  }
+  return NULL;
+}
+
+/* Returns the node with the largest key below 'key' (if 'below') or the
+ * smallest key above 'key' (otherwise) in the tree rooted at 'node', where
+ * 'key' itself counts if 'inclusive'. Stores its rank in 'rank' if it is
+ * not NULL.
+ */
+RAVL_Node *neighbour(RAVL_Node *node, int key, int below, int inclusive, int *rank) {
+  RAVL_Node *best = NULL;
+  int best_rank = NOTIN;
+  int seen = 0;  // keys known to be smaller than the current subtree
+
+  while (node != NULL) {
+    int here = seen + size(node->left) + 1;
+    if (inclusive && node->key == key) {
+      best = node;
+      best_rank = here;
+      break;
+    }
+    if (below ? node->key < key : node->key > key) {
+      best = node;  // a candidate; look for a closer one
+      best_rank = here;
+    }
+    if (node->key < key || (node->key == key && !below)) {
+      seen = here;
+      node = node->right;
+    } else {
+      node = node->left;
+    }
+  }
+
+  if (rank != NULL) {
+    *rank = best_rank;
+  }
+  return best;
+}
+
+RAVL_Node *findFloor(RAVL_Node *node, int key, int *rank) {
+  return neighbour(node, key, 1, 1, rank);
+}
+
+RAVL_Node *findCeiling(RAVL_Node *node, int key, int *rank) {
+  return neighbour(node, key, 0, 1, rank);
+}
+
+RAVL_Node *findPredecessor(RAVL_Node *node, int key, int *rank) {
+  return neighbour(node, key, 1, 0, rank);
+}
+
+RAVL_Node *findSuccessor(RAVL_Node *node, int key, int *rank) {
+  return neighbour(node, key, 0, 0, rank);
+}
+
+/* Returns the number of keys smaller than 'key' in the tree rooted at
+ * 'node'.
+ */
+int countLess(RAVL_Node *node, int key) {
+  int count = 0;
+
+  while (node != NULL) {
+    if (node->key < key) {
+      count += size(node->left) + 1;
+      node = node->right;
+    } else {
+      node = node->left;
+    }
+  }
+  return count;
+}
+
+int countInRange(RAVL_Node *node, int lo, int hi) {
+  if (lo > hi) {
+    return 0;
+  }
+  int below = countLess(node, lo);
+  if (hi == INT_MAX) {  // hi + 1 would overflow
+    return size(node) - below;
+  }
+  return countLess(node, hi + 1) - below;
+}
+
+RAVL_Node *selectInRange(RAVL_Node *node, int lo, int hi, int k) {
+  if (k < 1 || lo > hi) {
+    return NULL;
+  }
+  RAVL_Node *found = findRank(node, countLess(node, lo) + k);
+  if (found == NULL || found->key > hi) {
+    return NULL;
+  }
+  return found;
+}
+
+int quantilesInRange(RAVL_Node *node, int lo, int hi, const double *qs, int nq,
+                     RAVL_Node **out) {
+  int m = countInRange(node, lo, hi);
+  int base = m == 0 ? 0 : countLess(node, lo);
+
+  for (int i = 0; i < nq; i++) {
+    if (m == 0) {
+      out[i] = NULL;
+      continue;
+    }
+    double pos = qs[i] * m;
+    int k = (int)pos;
+    if (k < pos) {
+      k++;  // ceil
+    }
+    if (k < 1) {
+      k = 1;
+    }
+    if (k > m) {
+      k = m;
+    }
+    out[i] = findRank(node, base + k);
+  }
+  return m;
+}
+
+/* Visits the 'count' nodes that 'it' returns next, storing the i'th one in
+ * 'out[i]', its key in 'keys[i]' and its value in 'values[i]' (for each
+ * array that is not NULL). There must be at least 'count' of them. Returns
+ * 'count'.
+ */
+int streamIter(RAVL_Iterator *it, int count, RAVL_Node **out, int *keys, void **values) {
+  for (int i = 0; i < count; i++) {
+    RAVL_Node *node = iterNext(it);
+    if (out != NULL) {
+      out[i] = node;
+    }
+    if (keys != NULL) {
+      keys[i] = node->key;
+    }
+    if (values != NULL) {
+      values[i] = node->value;
+    }
+  }
+  return count;
+}
+
+void iterFromRank(RAVL_Iterator *it, RAVL_Node *node, int rank, int reverse) {
+  it->top = 0;
+  it->reverse = reverse;
+
+  // walk to rank 'rank', keeping the ancestors that come after it
+  while (node != NULL) {
+    int here = size(node->left) + 1;
+    if (rank == here) {
+      it->stack[it->top++] = node;
+      break;
+    }
+    if (rank < here) {
+      if (!reverse) {
+        it->stack[it->top++] = node;
+      }
+      node = node->left;
+    } else {
+      if (reverse) {
+        it->stack[it->top++] = node;
+      }
+      rank -= here;
+      node = node->right;
+    }
+  }
+}
+
+RAVL_Node *iterNext(RAVL_Iterator *it) {
+  if (it->top == 0) {
+    return NULL;
+  }
+
+  RAVL_Node *next = it->stack[--it->top];
+  RAVL_Node *node = it->reverse ? next->left : next->right;
+  while (node != NULL) {
+    it->stack[it->top++] = node;
+    node = it->reverse ? node->right : node->left;
+  }
+  return next;
+}
+
+int takeSmallest(RAVL_Node *node, int k, RAVL_Node **out) {
+  return takeRangeByRank(node, 1, k, out);
+}
+
+int takeLargest(RAVL_Node *node, int k, RAVL_Node **out) {
+  int n = size(node);
+  if (k > n) {
+    k = n;
+  }
+  if (k <= 0) {
+    return 0;
+  }
+  RAVL_Iterator it;
+  iterFromRank(&it, node, n, 1);
+  return streamIter(&it, k, out, NULL, NULL);
+}
+
+int takeRangeByRank(RAVL_Node *node, int r1, int r2, RAVL_Node **out) {
+  if (r1 < 1) {
+    r1 = 1;
+  }
+  if (r2 > size(node)) {
+    r2 = size(node);
+  }
+  if (r1 > r2) {
+    return 0;
+  }
+  RAVL_Iterator it;
+  iterFromRank(&it, node, r1, 0);
+  return streamIter(&it, r2 - r1 + 1, out, NULL, NULL);
+}
+
+int takeRangeByRankDesc(RAVL_Node *node, int d1, int d2, RAVL_Node **out) {
+  int n = size(node);
+  if (d1 < 1) {
+    d1 = 1;
+  }
+  if (d2 > n) {
+    d2 = n;
+  }
+  if (d1 > d2) {
+    return 0;
+  }
+  RAVL_Iterator it;
+  iterFromRank(&it, node, n - d1 + 1, 1);
+  return streamIter(&it, d2 - d1 + 1, out, NULL, NULL);
+}
+
+int exportRankRange(RAVL_Node *node, int r1, int r2, int *keys, void **values) {
+  if (r1 < 1) {
+    r1 = 1;
+  }
+  if (r2 > size(node)) {
+    r2 = size(node);
+  }
+  if (r1 > r2) {
+    return 0;
+  }
+  RAVL_Iterator it;
+  iterFromRank(&it, node, r1, 0);
+  return streamIter(&it, r2 - r1 + 1, NULL, keys, values);
+}
+
+void rankBatch(RAVL_Node *node, const int *keys, int n, int *ranks) {
+  RAVL_Node *cur[BATCH_WIDTH];
+
+  for (int first = 0; first < n; first += BATCH_WIDTH) {
+    int width = n - first < BATCH_WIDTH ? n - first : BATCH_WIDTH;
+    int active = width;
+    for (int i = 0; i < width; i++) {
+      cur[i] = node;
+      ranks[first + i] = node == NULL ? NOTIN : 0;
+    }
+
+    while (active > 0) {
+      active = 0;
+      for (int i = 0; i < width; i++) {
+        RAVL_Node *at = cur[i];
+        if (at == NULL) {
+          continue;
+        }
+        int key = keys[first + i];
+        if (key == at->key) {
+          ranks[first + i] += size(at->left) + 1;
+          cur[i] = NULL;
+          continue;
+        }
+        if (key > at->key) {
+          ranks[first + i] += size(at->left) + 1;
+          cur[i] = at->right;
+        } else {
+          cur[i] = at->left;
+        }
+        if (cur[i] == NULL) {
+          ranks[first + i] = NOTIN;
+        } else {
+          __builtin_prefetch(cur[i]);
+          active++;
+        }
+      }
+    }
+  }
+}
+
+void findRankBatch(RAVL_Node *node, const int *ranks, int n, RAVL_Node **nodes) {
+  RAVL_Node *cur[BATCH_WIDTH];
+  int left[BATCH_WIDTH];  // rank still to find within cur[i]
+
+  for (int first = 0; first < n; first += BATCH_WIDTH) {
+    int width = n - first < BATCH_WIDTH ? n - first : BATCH_WIDTH;
+    int active = width;
+    for (int i = 0; i < width; i++) {
+      cur[i] = node;
+      left[i] = ranks[first + i];
+      nodes[first + i] = NULL;
+    }
+
+    while (active > 0) {
+      active = 0;
+      for (int i = 0; i < width; i++) {
+        RAVL_Node *at = cur[i];
+        if (at == NULL) {
+          continue;
+        }
+        int r = size(at->left) + 1;
+        if (left[i] == r) {
+          nodes[first + i] = at;
+          cur[i] = NULL;
+          continue;
+        }
+        if (left[i] < r) {
+          cur[i] = at->left;
+        } else {
+          left[i] -= r;
+          cur[i] = at->right;
+        }
+        if (cur[i] != NULL) {
+          __builtin_prefetch(cur[i]);
+          active++;
+        }
+      }
+    }
+  }
+}
+
+/*************************************************************************
+ ** Join-based functions
+ ** Run in O(log n), where n is the number of nodes involved.
+ *************************************************************************/
+
+RAVL_Node *join(RAVL_Node *left, RAVL_Node *mid, RAVL_Node *right) {
+  if (height(left) > height(right) + 1) {
+    left->right = join(left->right, mid, right);
+    return rebalance(left);
+  }
+  if (height(right) > height(left) + 1) {
+    right->left = join(left, mid, right->left);
+    return rebalance(right);
+  }
+  mid->left = left;
+  mid->right = right;
+  updateHeight(mid);
+  updateSize(mid);
+  return mid;
+}
+
+RAVL_Node *join2(RAVL_Node *left, RAVL_Node *right) {
+  if (right == NULL) {
+    return left;
+  }
+  RAVL_Node *min;
+  right = detachMin(right, &min);
+  return join(left, min, right);
+}
+
+RAVL_Node *split(RAVL_Node *node, int key, RAVL_Node **left, RAVL_Node **right) {
+  if (node == NULL) {
+    *left = NULL;
+    *right = NULL;
+    return NULL;
+  }
+
+  RAVL_Node *l = node->left;
+  RAVL_Node *r = node->right;
+  RAVL_Node *found;
+  node->left = NULL;
+  node->right = NULL;
+  updateHeight(node);
+  updateSize(node);
+
+  if (key < node->key) {
+    found = split(l, key, left, &l);
+    *right = join(l, node, r);
+  } else if (key > node->key) {
+    found = split(r, key, &r, right);
+    *left = join(l, node, r);
+  } else {
+    found = node;
+    *left = l;
+    *right = r;
+  }
+  return found;
+}
+
+/*************************************************************************
+ ** Tree handle functions
+ *************************************************************************/
+
+/* Returns the node with the smallest key (if 'left') or the largest key
+ * (otherwise) in the non-empty tree rooted at 'node'.
+ */
+RAVL_Node *extreme(RAVL_Node *node, int left) {
+  while ((left ? node->left : node->right) != NULL) {
+    node = left ? node->left : node->right;
+  }
+  return node;
+}
+
+/* Finds the smallest and largest live nodes of 'tree' again. */
+void refreshBounds(RAVL_Tree *tree) {
+  tree->min = liveFindRank(tree->root, 1);
+  tree->max = liveFindRank(tree->root, live(tree->root));
+}
+
+/* Purges the tombstones of 'tree' if they are more than its lazy
+ * threshold allows.
+ */
+void checkTombstones(RAVL_Tree *tree) {
+  int n = size(tree->root);
+  if (n > 0 && n - tree->root->live > tree->lazy * n) {
+    treePurge(tree);
+  }
+}
+
+RAVL_Tree *treeCreate(RAVL_Allocator *tree_allocator) {
+  RAVL_Tree *tree = (RAVL_Tree *)calloc(1, sizeof(RAVL_Tree));
+  if (tree != NULL) {
+    tree->allocator = tree_allocator;
+  }
+  return tree;
+}
+
+RAVL_Node *treeInsert(RAVL_Tree *tree, int key, void *value) {
+  RAVL_Node *found;
+  int existed;
+
+  tree->root = insert_(tree->allocator, tree->root, key, value, NULL, NULL, 1, &found,
+                       &existed);
+
+  if (found == NULL) {
+    return NULL;
+  }
+  if (existed) {
+    tree->stats.updates++;
+    return found;
+  }
+  tree->stats.inserts++;
+  if (tree->min == NULL || key < tree->min->key) {
+    tree->min = found;
+  }
+  if (tree->max == NULL || key > tree->max->key) {
+    tree->max = found;
+  }
+  return found;
+}
+
+int treeDelete(RAVL_Tree *tree, int key, void **value) {
+  void *v = NULL;
+  int deleted = 0;
+  int was_min = tree->min != NULL && tree->min->key == key;
+  int was_max = tree->max != NULL && tree->max->key == key;
+
+  if (tree->lazy > 0) {
+    deleted = markDeleted(tree->root, key, value);
+  } else {
+    tree->root = delete_(tree->allocator, tree->root, key, &v, &deleted);
+    if (value != NULL) {
+      *value = v;
+    }
+  }
+
+  if (!deleted) {
+    return 0;
+  }
+  tree->stats.deletes++;
+  if (was_min || was_max) {
+    refreshBounds(tree);
+  }
+  if (tree->lazy > 0) {
+    checkTombstones(tree);
+  }
+  return 1;
+}
+
+void treeSetLazy(RAVL_Tree *tree, double threshold) {
+  tree->lazy = threshold > 0 ? threshold : 0;
+  if (tree->lazy == 0) {
+    treePurge(tree);
+  }
+}
+
+void treePurge(RAVL_Tree *tree) {
+  tree->root = purgeDeleted_(tree->allocator, tree->root);
+}
+
+/* Does the work of treePopMin() (if 'min') or treePopMax() (otherwise). */
+int treePop(RAVL_Tree *tree, int min, int *key, void **value) {
+  RAVL_Node *target = min ? tree->min : tree->max;
+  if (target == NULL) {
+    return 0;
+  }
+
+  while (isDeleted(extreme(tree->root, min))) {
+    tree->root = pop(tree->allocator, tree->root, min, NULL, NULL);  // tombstones on the way
+  }
+  tree->root = pop(tree->allocator, tree->root, min, key, value);
+
+  tree->stats.deletes++;
+  refreshBounds(tree);
+  return 1;
+}
+
+int treePopMin(RAVL_Tree *tree, int *key, void **value) {
+  return treePop(tree, 1, key, value);
+}
+
+int treePopMax(RAVL_Tree *tree, int *key, void **value) {
+  return treePop(tree, 0, key, value);
+}
+
+int treeDeleteRank(RAVL_Tree *tree, int rank, int *key, void **value) {
+  int n = live(tree->root);
+  if (rank < 1 || rank > n) {
+    return 0;
+  }
+
+  if (tree->lazy > 0) {
+    markRank(tree->root, rank, key, value);
+  } else {
+    tree->root = deleteRank_(tree->allocator, tree->root, rank, key, value);
+  }
+
+  tree->stats.deletes++;
+  if (rank == 1 || rank == n) {
+    refreshBounds(tree);
+  }
+  if (tree->lazy > 0) {
+    checkTombstones(tree);
+  }
+  return 1;
+}
+
+RAVL_Node *treeSearch(RAVL_Tree *tree, int key) {
+  tree->stats.lookups++;
+  return liveSearch(tree->root, key);
+}
+
+int treeRank(RAVL_Tree *tree, int key) {
+  tree->stats.lookups++;
+  return liveRank(tree->root, key);
+}
+
+RAVL_Node *treeFindRank(RAVL_Tree *tree, int rank) {
+  tree->stats.lookups++;
+  if (rank == 1) {
+    return tree->min;
+  }
+  if (rank == live(tree->root)) {
+    return tree->max;
+  }
+  return liveFindRank(tree->root, rank);
+}
+
+RAVL_Node *treeMin(RAVL_Tree *tree) { return tree->min; }
+
+RAVL_Node *treeMax(RAVL_Tree *tree) { return tree->max; }
+
+int treeSize(RAVL_Tree *tree) { return live(tree->root); }
+
+RAVL_Node *treeRoot(RAVL_Tree *tree) { return tree->root; }
+
+void treeStats(RAVL_Tree *tree, RAVL_TreeStats *stats) { *stats = tree->stats; }
+
+void treeDestroy(RAVL_Tree *tree) {
+  if (tree == NULL) {
+    return;
+  }
+  deleteTree_(tree->allocator, tree->root);
+  free(tree);
+}
@@ -15,9 +15,15 @@
 #define __RAVL_tree_header
 
 #define NOTIN -1
+#define BATCH_WIDTH 8  // lookups interleaved by the batch functions
+#define MAX_HEIGHT 64  // bound on the height of any RAVL tree of int keys
 
 typedef struct ravl_node {
   int key;                 // key stored in this node
+  union {
+    int live;              // number of nodes in this tree that are not tombstones
+    unsigned version;      // version lock, in a concurrent tree (RAVL_concurrent.h)
+  };
   void* value;             // value associated with this node's key
   int height;              // height of tree rooted at this node
   int size;               // size of tree rooted at this node
@@ -25,6 +31,46 @@ typedef struct ravl_node {
   struct ravl_node* right;  // this node's right child
 } RAVL_Node;
 
+typedef struct ravl_iterator {
+  RAVL_Node* stack[MAX_HEIGHT];  // nodes still to visit, next on top
+  int top;
+  int reverse;                   // 1 if visiting keys in decreasing order
+} RAVL_Iterator;
+
+typedef struct ravl_allocator {
+  void* (*alloc)(void* ctx);              // returns memory for one node
+  void (*release)(void* ctx, void* node); // takes back a node from alloc()
+  void* ctx;                              // passed to both functions
+} RAVL_Allocator;
+
+typedef void (*RAVL_Augment)(RAVL_Node* node);  // see rebalanceAugmented()
+
+typedef struct ravl_tree RAVL_Tree;  // a tree handle, see treeCreate()
+
+typedef struct ravl_tree_stats {
+  long inserts;  // keys added
+  long updates;  // inserts that replaced the value of an existing key
+  long deletes;  // keys removed
+  long lookups;  // searches and rank queries
+} RAVL_TreeStats;
+
+/* Makes all RAVL trees take their nodes from 'allocator' (which must stay
+ * valid while in use) instead of malloc() and free(). Passing NULL restores
+ * malloc() and free(). Only change the allocator when no tree holds nodes
+ * from the previous one, or free those trees with the previous one first.
+*/
+void setAllocator(RAVL_Allocator* allocator);
+
+/* For trees whose nodes start with a RAVL_Node and keep more per subtree
+ * than its height and size (see RAVL_interval.h): updates the height and
+ * size of 'node' and, if it is out of balance by 2, performs the rotation
+ * that restores the balance, as insert() and delete() do on the way up.
+ * 'augment' is called on 'node' and on every node a rotation gives new
+ * children, after their children are up to date and their own height and
+ * size are set. Returns the root of the resulting subtree.
+*/
+RAVL_Node* rebalanceAugmented(RAVL_Node* node, RAVL_Augment augment);
+
 /* Returns the node, from the tree rooted at 'node', that contains key 'key'.
  * Returns NULL if 'key' is not in the tree.
 */
@@ -36,22 +82,139 @@ RAVL_Node* search(RAVL_Node* node, int key);
  */
 RAVL_Node* insert(RAVL_Node* node, int key, void* value);
 
+/* Does what insert() does, and also stores in 'found' the node holding
+ * 'key' (NULL if memory runs out) and in 'existed' whether 'key' was
+ * already in the tree (each if it is not NULL), without a second walk.
+*/
+RAVL_Node* upsert(RAVL_Node* node, int key, void* value, RAVL_Node** found, int* existed);
+
+/* Finds the node holding 'key' in the RAVL tree rooted at 'node', or
+ * inserts 'key' with the value factory(key, ctx) if it is not there, in a
+ * single walk. 'factory' is only called for a new key, and the value of an
+ * existing key is left alone. Stores the node in 'found' (if it is not
+ * NULL; NULL if memory runs out) and returns the root of the resulting tree.
+*/
+RAVL_Node* getOrInsert(RAVL_Node* node, int key, void* (*factory)(int key, void* ctx),
+                       void* ctx, RAVL_Node** found);
+
+/* Does what insert() does and also stores in 'rank' (if it is not NULL) the
+ * descending rank of 'key' in the resulting tree (1 + the number of keys
+ * larger than 'key'), counted in the same walk.
+*/
+RAVL_Node* insertWithRank(RAVL_Node* node, int key, void* value, int* rank);
+
+/* Stores in 'greater[i]' (if 'greater' is not NULL) the number of keys
+ * among keys[0..i-1] that are larger than keys[i], and returns the total:
+ * the number of inversions in 'keys'. The keys need not be distinct. Runs
+ * in O(n log n) using a temporary RAVL tree. Returns -1 if memory runs out.
+*/
+long long countInversions(const int* keys, int n, int* greater);
+
 /* Deletes the node with key 'key' from the RAVL tree rooted at 'node'.  If
  * 'key' is not a key in the tree, the tree is unchanged. Returns the root of
  * the resulting tree.
 */
 RAVL_Node* delete(RAVL_Node* node, int key);
 
+/* Does what delete() does, and also stores the value that was associated
+ * with 'key' in 'value' and whether 'key' was in the tree in 'deleted'
+ * (each if it is not NULL; 'value' gets NULL if it was not), so that the
+ * caller can free the value without looking it up first.
+*/
+RAVL_Node* deleteAndGet(RAVL_Node* node, int key, void** value, int* deleted);
+
+/* Deletes the node with rank 'rank' from the RAVL tree rooted at 'node',
+ * storing its key in 'key' and its value in 'value' (each if it is not
+ * NULL), and returns the root of the resulting tree. Finds the node by
+ * subtree sizes in the same walk that deletes it. If there is no such
+ * rank, the tree is unchanged and nothing is stored.
+*/
+RAVL_Node* deleteRank(RAVL_Node* node, int rank, int* key, void** value);
+
+/* Delete the node with the smallest key (popMin) or the largest key
+ * (popMax) from the RAVL tree rooted at 'node', storing its key in 'key'
+ * and its value in 'value' (each if it is not NULL), and return the root of
+ * the resulting tree. They walk straight down the leftmost or rightmost
+ * path, without comparing keys, and only rebalance along it. They store
+ * nothing if the tree is empty.
+*/
+RAVL_Node* popMin(RAVL_Node* node, int* key, void** value);
+RAVL_Node* popMax(RAVL_Node* node, int* key, void** value);
+
+/* Lazy deletion: markDeleted() turns a node into a tombstone instead of
+ * removing it, so a burst of deletes costs one walk each and no rotations.
+ * Every node counts the nodes in its subtree that are not tombstones in
+ * 'live', kept up to date next to 'size'. The live* functions below answer
+ * queries as if the tombstones were gone; the other queries, the iterators
+ * and the bulk functions still see them, so purge a tree before handing it
+ * to those. insert(), insertWithRank(), upsert() and getOrInsert() bring a
+ * tombstone back to life (insertWithRank() also ranks among live keys
+ * only), and delete() removes one for good.
+*/
+
+/* Marks the node with key 'key' in the RAVL tree rooted at 'node' as a
+ * tombstone, storing its value in 'value' (if it is not NULL). Returns 1,
+ * or 0 if 'key' is not in the tree or is a tombstone already.
+*/
+int markDeleted(RAVL_Node* node, int key, void** value);
+
+/* Returns 1 if 'node' is a tombstone, 0 otherwise.
+*/
+int isDeleted(RAVL_Node* node);
+
+/* Return what search(), rank() and findRank() return for the tree rooted
+ * at 'node' once its tombstones are removed, without removing them.
+*/
+RAVL_Node* liveSearch(RAVL_Node* node, int key);
+int liveRank(RAVL_Node* node, int key);
+RAVL_Node* liveFindRank(RAVL_Node* node, int rank);
+
+/* Frees the tombstones of the RAVL tree rooted at 'node' and returns the
+ * root of a perfectly balanced tree of the remaining nodes, which are
+ * relinked rather than copied. Runs in O(n). If memory for the O(n)
+ * scratch array runs out, returns 'node' unchanged.
+*/
+RAVL_Node* purgeDeleted(RAVL_Node* node);
+
 /* Returns the rank of the node, from the tree rooted at 'node', that
  * contains key 'key'.  Returns NOTIN if 'key' is not in the tree.
 */
 int rank(RAVL_Node* node, int key);
 
+/* Returns the node, from the tree rooted at 'node', that contains key 'key'
+ * and stores its rank in 'rank' (if it is not NULL), in a single walk: the
+ * same answers as search() and rank() together, for the cost of one.
+ * Returns NULL (storing NOTIN) if 'key' is not in the tree. findRank()
+ * already gives both the node and, through it, the key for a rank.
+*/
+RAVL_Node* searchWithRank(RAVL_Node* node, int key, int* rank);
+
 /* Returns the node, from the tree rooted at 'node', that has rank 'rank'.
  * Returns NULL if there is no node with rank 'rank' in the tree.
 */
 RAVL_Node* findRank(RAVL_Node* node, int rank);
 
+/* Return the descending rank of key 'key' (rankDesc) and the node with
+ * descending rank 'rank' (findRankDesc) in the tree rooted at 'node', where
+ * the largest key has descending rank 1. Each is a single walk, and they
+ * return NOTIN and NULL where rank() and findRank() would.
+*/
+int rankDesc(RAVL_Node* node, int key);
+RAVL_Node* findRankDesc(RAVL_Node* node, int rank);
+
+/* Return the node, from the tree rooted at 'node', with the largest key
+ * that is at most 'key' (findFloor), the smallest key that is at least
+ * 'key' (findCeiling), the largest key smaller than 'key'
+ * (findPredecessor) or the smallest key larger than 'key' (findSuccessor).
+ * 'key' need not be in the tree. If 'rank' is not NULL, stores the rank of
+ * the node found in it, found in the same walk. Return NULL (storing NOTIN)
+ * if there is no such node.
+*/
+RAVL_Node* findFloor(RAVL_Node* node, int key, int* rank);
+RAVL_Node* findCeiling(RAVL_Node* node, int key, int* rank);
+RAVL_Node* findPredecessor(RAVL_Node* node, int key, int* rank);
+RAVL_Node* findSuccessor(RAVL_Node* node, int key, int* rank);
+
 /* Prints the keys of the RAVL tree rooted at 'node', in the in-order
  * traversal order.
  */
@@ -61,4 +224,196 @@ void printTreeInorder(RAVL_Node* node);
  */
 void deleteTree(RAVL_Node* node);
 
+/* Stores the keys (and, if 'values' is not NULL, the values) of the RAVL tree
+ * rooted at 'node' into 'keys' (and 'values') in in-order traversal order.
+ * The arrays must have room for size(node) entries. Returns the number of
+ * entries stored.
+ */
+int flattenTree(RAVL_Node* node, int* keys, void** values);
+
+/* Returns the root of a new, perfectly balanced RAVL tree holding the 'n'
+ * keys in 'keys', which must be sorted in increasing order and distinct. If
+ * 'values' is not NULL, 'values[i]' is associated with 'keys[i]'; otherwise
+ * all values are NULL. Runs in O(n). Returns NULL if 'n' is 0 or memory runs
+ * out (in which case nothing is leaked).
+ */
+RAVL_Node* buildTree(const int* keys, void** values, int n);
+
+/* Returns the number of keys 'k' with lo <= k <= hi in the tree rooted at
+ * 'node'.
+*/
+int countInRange(RAVL_Node* node, int lo, int hi);
+
+/* Returns the node, from the tree rooted at 'node', with the 'k'th smallest
+ * key among the keys in [lo, hi] (k = 1 gives the smallest). Returns NULL
+ * if fewer than 'k' keys lie in that range.
+*/
+RAVL_Node* selectInRange(RAVL_Node* node, int lo, int hi, int k);
+
+/* Stores in 'out[i]' the node holding the 'qs[i]' quantile of the keys in
+ * [lo, hi] of the tree rooted at 'node', for 0 <= i < nq: the key with
+ * position ceil(qs[i] * m) among those m keys (at least the first, at most
+ * the last), so 0.5 gives the lower median. Stores NULL if the range is
+ * empty. Returns m. Runs in O((nq + 2) log n).
+*/
+int quantilesInRange(RAVL_Node* node, int lo, int hi, const double* qs, int nq,
+                     RAVL_Node** out);
+
+/* Store in 'out' the nodes with the 'k' smallest keys in increasing order
+ * (takeSmallest) or the 'k' largest keys in decreasing order (takeLargest)
+ * of the tree rooted at 'node'. 'out' must have room for 'k' nodes. Return
+ * the number of nodes stored, which is less than 'k' only if the tree is
+ * smaller. Run in O(log n + k) and allocate nothing.
+*/
+int takeSmallest(RAVL_Node* node, int k, RAVL_Node** out);
+int takeLargest(RAVL_Node* node, int k, RAVL_Node** out);
+
+/* Stores in 'out' the nodes with ranks r1 to r2 (inclusive, clipped to the
+ * ranks in the tree) of the tree rooted at 'node', in increasing order.
+ * 'out' must have room for r2 - r1 + 1 nodes. Returns the number of nodes
+ * stored. Runs in O(log n + r2 - r1) and allocates nothing.
+*/
+int takeRangeByRank(RAVL_Node* node, int r1, int r2, RAVL_Node** out);
+
+/* Stores in 'out' the nodes with descending ranks d1 to d2 (inclusive,
+ * clipped to the ranks in the tree) of the tree rooted at 'node', in
+ * decreasing order of keys. Otherwise like takeRangeByRank().
+*/
+int takeRangeByRankDesc(RAVL_Node* node, int d1, int d2, RAVL_Node** out);
+
+/* Starts iterator 'it' over the tree rooted at 'node' at the node with rank
+ * 'rank', going in increasing order of keys, or in decreasing order if
+ * 'reverse'. A rank past the first or last node starts at that node (or
+ * yields nothing if it lies beyond the end of the walk), so rank 1 and
+ * rank size(node) with 'reverse' walk the whole tree. Costs O(log n).
+*/
+void iterFromRank(RAVL_Iterator* it, RAVL_Node* node, int rank, int reverse);
+
+/* Returns the next node from iterator 'it', or NULL when it is done, in
+ * amortized O(1). The tree must not change while 'it' is in use.
+*/
+RAVL_Node* iterNext(RAVL_Iterator* it);
+
+/* Stores the keys of the nodes with ranks r1 to r2 (inclusive, clipped to
+ * the ranks in the tree) of the tree rooted at 'node' in 'keys', in
+ * increasing order, and their values in the matching entries of 'values'
+ * if it is not NULL: dense columns ready for vectorized processing. The
+ * arrays must have room for r2 - r1 + 1 entries. Returns the number of
+ * entries stored. Runs in O(log n + r2 - r1) and allocates nothing.
+*/
+int exportRankRange(RAVL_Node* node, int r1, int r2, int* keys, void** values);
+
+/* Stores in 'ranks[i]' the rank of 'keys[i]' in the RAVL tree rooted at
+ * 'node' (NOTIN if it is not in the tree), for 0 <= i < n. Walks
+ * BATCH_WIDTH lookups down the tree together, prefetching each one's next
+ * node, so that their cache misses overlap.
+*/
+void rankBatch(RAVL_Node* node, const int* keys, int n, int* ranks);
+
+/* Stores in 'nodes[i]' the node with rank 'ranks[i]' in the RAVL tree rooted
+ * at 'node' (NULL if there is none), for 0 <= i < n. Interleaves lookups as
+ * rankBatch() does.
+*/
+void findRankBatch(RAVL_Node* node, const int* ranks, int n, RAVL_Node** nodes);
+
+/* Returns the root of the RAVL tree holding the nodes of the RAVL trees
+ * rooted at 'left' and 'right' and the single node 'mid' (whose children
+ * are overwritten), where every key in 'left' is smaller than mid's key and
+ * every key in 'right' is larger. Runs in O(|height(left) - height(right)|).
+*/
+RAVL_Node* join(RAVL_Node* left, RAVL_Node* mid, RAVL_Node* right);
+
+/* Returns the root of the RAVL tree holding the nodes of the RAVL trees
+ * rooted at 'left' and 'right', where every key in 'left' is smaller than
+ * every key in 'right'.
+*/
+RAVL_Node* join2(RAVL_Node* left, RAVL_Node* right);
+
+/* Splits the RAVL tree rooted at 'node' into the RAVL tree of its keys
+ * smaller than 'key', stored in 'left', and the RAVL tree of its keys
+ * larger than 'key', stored in 'right'. Returns the node with key 'key',
+ * detached from both, or NULL if 'key' is not in the tree. No node is
+ * allocated or freed.
+*/
+RAVL_Node* split(RAVL_Node* node, int key, RAVL_Node** left, RAVL_Node** right);
+
+/* A tree handle owns a RAVL tree together with the allocator its nodes come
+ * from, operation counts, and its smallest and largest nodes, which are
+ * kept up to date as keys come and go. Nodes never move between keys, so
+ * the cached nodes only change when a smaller or larger key is inserted or
+ * when they are deleted themselves.
+*/
+
+/* Returns a new, empty tree handle whose nodes come from 'allocator' (or
+ * malloc() and free() if it is NULL), or NULL if memory runs out. The
+ * handle passes its allocator straight to the calls that allocate or free
+ * nodes and never touches the one set by setAllocator(), so handles with
+ * different allocators can be used on different threads at once.
+*/
+RAVL_Tree* treeCreate(RAVL_Allocator* allocator);
+
+/* Inserts 'key' with value 'value' into 'tree', replacing the value if
+ * 'key' is already there. Returns the node holding 'key', or NULL if
+ * memory runs out.
+*/
+RAVL_Node* treeInsert(RAVL_Tree* tree, int key, void* value);
+
+/* Deletes 'key' from 'tree', storing its value in 'value' if it is not
+ * NULL. Returns 1 if 'key' was in 'tree', 0 otherwise. In lazy mode the
+ * node becomes a tombstone (see markDeleted()).
+*/
+int treeDelete(RAVL_Tree* tree, int key, void** value);
+
+/* Switches 'tree' to lazy deletion if 'threshold' is positive: deletes
+ * leave tombstones, and once more than 'threshold' of the nodes (a
+ * fraction, e.g. 0.25) are tombstones, the next delete purges them all in
+ * one rebuild. A 'threshold' of 0 switches lazy deletion off and purges
+ * the tombstones now. All tree handle queries skip tombstones.
+*/
+void treeSetLazy(RAVL_Tree* tree, double threshold);
+
+/* Removes the tombstones of 'tree' now, as purgeDeleted() does.
+*/
+void treePurge(RAVL_Tree* tree);
+
+/* Delete the smallest (treePopMin) or largest (treePopMax) key from
+ * 'tree', as popMin() and popMax() do. Return 1, or 0 if 'tree' is empty.
+*/
+int treePopMin(RAVL_Tree* tree, int* key, void** value);
+int treePopMax(RAVL_Tree* tree, int* key, void** value);
+
+/* Deletes the key with rank 'rank' from 'tree', as deleteRank() does.
+ * Returns 1, or 0 if there is no such rank.
+*/
+int treeDeleteRank(RAVL_Tree* tree, int rank, int* key, void** value);
+
+/* Return what search(), rank() and findRank() return for the tree in
+ * 'tree'. treeFindRank() takes O(1) for the first and last ranks.
+*/
+RAVL_Node* treeSearch(RAVL_Tree* tree, int key);
+int treeRank(RAVL_Tree* tree, int key);
+RAVL_Node* treeFindRank(RAVL_Tree* tree, int rank);
+
+/* Return the node with the smallest key (treeMin) or the largest key
+ * (treeMax) in 'tree', or NULL if it is empty, and the number of keys in
+ * 'tree' (treeSize), in O(1).
+*/
+RAVL_Node* treeMin(RAVL_Tree* tree);
+RAVL_Node* treeMax(RAVL_Tree* tree);
+int treeSize(RAVL_Tree* tree);
+
+/* Returns the root of the tree in 'tree', for queries the handle does not
+ * offer. The tree must only be changed through the handle, and may hold
+ * tombstones in lazy mode.
+*/
+RAVL_Node* treeRoot(RAVL_Tree* tree);
+
+/* Stores the operation counts of 'tree' in 'stats'.
+*/
+void treeStats(RAVL_Tree* tree, RAVL_TreeStats* stats);
+
+/* Frees 'tree' and all of its nodes.
+*/
+void treeDestroy(RAVL_Tree* tree);
+
 #endif
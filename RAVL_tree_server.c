@@ -0,0 +1,356 @@
+/*
+ *  A standalone server that shares one in-memory RAVL tree between several
+ *  local processes. It accepts the same commands as the tester ((s)earch,
+ *  (i)nsert, (d)elete, (r)ank, (f)ind rank), but over a Unix domain socket
+ *  using a compact binary protocol.
+ *
+ *  Each request is REQ_SIZE bytes: a one-byte command followed by a 32-bit
+ *  argument (a key, or a rank for 'f') in host byte order. Each response is
+ *  RESP_SIZE bytes: the one-byte command it answers, a one-byte status
+ *  (ST_OK or ST_NOTIN) and a 32-bit result:
+ *    s  -> the key, if found
+ *    i  -> the size of the tree after the insert
+ *    d  -> the size of the tree after the delete
+ *    r  -> the rank of the key, if found
+ *    f  -> the key with the given rank, if found
+ *  An unknown command is answered with ST_BADCMD.
+ *
+ *  Clients may pipeline any number of requests; responses come back in
+ *  request order. The server is a single-threaded epoll loop: every request
+ *  that arrived in one read is executed back to back and all of its
+ *  responses are sent with a single write. The server stops reading from a
+ *  client whose unsent responses exceed OUT_LIMIT bytes until it catches up.
+ *  A client may shut down its writing side once it has sent its requests:
+ *  it still gets every response before the server closes the connection.
+ *  A client whose responses the server has no memory for is disconnected.
+ *
+ *  Usage: ./server socket_path [input_file]
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "RAVL_tree.h"
+
+#define MAX_LIMIT 1024
+#define MAX_EVENTS 64
+#define BUF_SIZE 65536
+#define OUT_LIMIT (1 << 20)  // unsent response bytes before reading pauses
+
+#define REQ_SIZE 5
+#define RESP_SIZE 6
+
+#define ST_OK 0
+#define ST_NOTIN 1
+#define ST_BADCMD 2
+
+typedef struct client {
+  int fd;
+  char in[BUF_SIZE];   // bytes read but not yet executed
+  int in_len;
+  char* out;           // responses not yet written
+  int out_len;
+  int out_cap;
+  int eof;             // 1 once the client has shut down its writing side
+} Client;
+
+RAVL_Node* createTree(FILE* f);
+int openListener(const char* path);
+int setNonBlocking(int fd);
+void serve(int listen_fd);
+int handleClient(Client* c, uint32_t events);
+int readRequests(Client* c);
+int executeRequests(Client* c);
+int flushResponses(Client* c);
+void closeClient(int epfd, Client* c);
+
+static RAVL_Node* root = NULL;
+
+int main(int argc, char* argv[]) {
+  if (argc < 2) {
+    fprintf(stderr, "Usage: %s socket_path [input_file]\n", argv[0]);
+    exit(1);
+  }
+
+  // If user specified a file for reading, create a tree with keys from it.
+  if (argc > 2) {
+    FILE* f = fopen(argv[2], "r");
+    if (f == NULL) {
+      fprintf(stderr, "Unable to open the specified input file: %s\n", argv[2]);
+      exit(1);
+    }
+    root = createTree(f);
+    fclose(f);
+  }
+
+  signal(SIGPIPE, SIG_IGN);  // a vanished client must not kill the server
+  int listen_fd = openListener(argv[1]);
+  if (listen_fd < 0) {
+    perror("Unable to listen on the specified socket");
+    deleteTree(root);
+    exit(1);
+  }
+  printf("Serving a tree of %d keys on %s\n", root == NULL ? 0 : root->size, argv[1]);
+
+  serve(listen_fd);
+
+  close(listen_fd);
+  unlink(argv[1]);
+  deleteTree(root);
+  return 0;
+}
+
+RAVL_Node* createTree(FILE* f) {
+  char line[MAX_LIMIT];
+  RAVL_Node* tree = NULL;
+
+  while (fgets(line, MAX_LIMIT, f)) {
+    tree = insert(tree, atoi(line), NULL);  // no values, as in the tester
+  }
+  return tree;
+}
+
+int openListener(const char* path) {
+  struct sockaddr_un addr;
+
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) {
+    return -1;
+  }
+  unlink(path);  // remove a stale socket left by a previous run
+  if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 ||
+      listen(fd, SOMAXCONN) < 0 || setNonBlocking(fd) < 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+int setNonBlocking(int fd) {
+  int flags = fcntl(fd, F_GETFL, 0);
+  if (flags < 0) {
+    return -1;
+  }
+  return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+void serve(int listen_fd) {
+  struct epoll_event ev, events[MAX_EVENTS];
+  int epfd = epoll_create1(0);
+  if (epfd < 0) {
+    perror("epoll_create1");
+    return;
+  }
+
+  ev.events = EPOLLIN;
+  ev.data.ptr = NULL;  // NULL marks the listening socket
+  epoll_ctl(epfd, EPOLL_CTL_ADD, listen_fd, &ev);
+
+  while (1) {
+    int n = epoll_wait(epfd, events, MAX_EVENTS, -1);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      perror("epoll_wait");
+      break;
+    }
+
+    for (int i = 0; i < n; i++) {
+      Client* c = (Client*)events[i].data.ptr;
+
+      if (c == NULL) {  // new connections
+        int fd;
+        while ((fd = accept(listen_fd, NULL, NULL)) >= 0) {
+          c = (Client*)calloc(1, sizeof(Client));
+          if (c == NULL || setNonBlocking(fd) < 0) {
+            free(c);
+            close(fd);
+            continue;
+          }
+          c->fd = fd;
+          ev.events = EPOLLIN;
+          ev.data.ptr = c;
+          epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+        }
+        continue;
+      }
+
+      if (handleClient(c, events[i].events) < 0) {
+        closeClient(epfd, c);
+        continue;
+      }
+
+      // read only while the client may send more and is not too far behind
+      // on its responses, and only ask for EPOLLOUT while they are backed up
+      ev.events = (!c->eof && c->out_len < OUT_LIMIT ? EPOLLIN : 0) |
+                  (c->out_len > 0 ? EPOLLOUT : 0);
+      ev.data.ptr = c;
+      epoll_ctl(epfd, EPOLL_CTL_MOD, c->fd, &ev);
+    }
+  }
+  close(epfd);
+}
+
+/* Serves the client 'c' after epoll reported 'events' for it: reads and
+ * executes its requests (even after a hang-up, which can leave requests
+ * unread) and writes what responses it can. Returns -1 if the connection
+ * should be closed, 0 otherwise.
+ */
+int handleClient(Client* c, uint32_t events) {
+  if (events & EPOLLERR) {
+    return -1;
+  }
+  if ((events & (EPOLLIN | EPOLLHUP)) && !c->eof && c->out_len < OUT_LIMIT) {
+    if (readRequests(c) < 0 || executeRequests(c) < 0) {
+      return -1;
+    }
+  }
+  if (flushResponses(c) < 0) {
+    return -1;
+  }
+  // done once the client has nothing more to send and has every response
+  return c->eof && c->out_len == 0 ? -1 : 0;
+}
+
+/* Reads everything currently available from the client, setting 'c->eof'
+ * if it has shut down its writing side. Returns -1 if the read failed, 0
+ * otherwise.
+ */
+int readRequests(Client* c) {
+  while (c->in_len < BUF_SIZE) {
+    ssize_t got = read(c->fd, c->in + c->in_len, BUF_SIZE - c->in_len);
+    if (got > 0) {
+      c->in_len += got;
+    } else if (got == 0) {
+      c->eof = 1;
+      return 0;
+    } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+      return 0;
+    } else if (errno != EINTR) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/* Executes every complete request in the client's input buffer, appending
+ * the responses to its output buffer. A trailing partial request is kept
+ * for the next read. Returns -1 if there is no memory for the responses
+ * (the connection is then closed, since the requests could be neither
+ * answered nor left pending without epoll reporting them again and again),
+ * 0 otherwise.
+ */
+int executeRequests(Client* c) {
+  int n = c->in_len / REQ_SIZE;
+  if (n == 0) {
+    return 0;
+  }
+
+  if (c->out_len + n * RESP_SIZE > c->out_cap) {
+    int cap = c->out_len + n * RESP_SIZE;
+    char* out = (char*)realloc(c->out, cap);
+    if (out == NULL) {
+      return -1;
+    }
+    c->out = out;
+    c->out_cap = cap;
+  }
+
+  for (int i = 0; i < n; i++) {
+    char* req = c->in + i * REQ_SIZE;
+    char* resp = c->out + c->out_len;
+    char cmd = req[0];
+    int32_t arg, result = 0;
+    char status = ST_OK;
+    RAVL_Node* node;
+
+    memcpy(&arg, req + 1, sizeof(arg));
+
+    if (cmd == 's') {  // search
+      node = search(root, arg);
+      if (node != NULL) {
+        result = node->key;
+      } else {
+        status = ST_NOTIN;
+      }
+    } else if (cmd == 'i') {  // insert
+      root = insert(root, arg, NULL);
+      result = root == NULL ? 0 : root->size;
+    } else if (cmd == 'd') {  // delete
+      root = delete(root, arg);
+      result = root == NULL ? 0 : root->size;
+    } else if (cmd == 'r') {  // rank
+      result = rank(root, arg);
+      if (result == NOTIN) {
+        status = ST_NOTIN;
+      }
+    } else if (cmd == 'f') {  // find rank
+      node = findRank(root, arg);
+      if (node != NULL) {
+        result = node->key;
+      } else {
+        status = ST_NOTIN;
+      }
+    } else {
+      status = ST_BADCMD;
+    }
+
+    resp[0] = cmd;
+    resp[1] = status;
+    memcpy(resp + 2, &result, sizeof(result));
+    c->out_len += RESP_SIZE;
+  }
+
+  c->in_len -= n * REQ_SIZE;
+  memmove(c->in, c->in + n * REQ_SIZE, c->in_len);
+  return 0;
+}
+
+/* Writes as many pending responses as the socket accepts. Returns -1 if the
+ * write failed, 0 otherwise.
+ */
+int flushResponses(Client* c) {
+  int done = 0;
+
+  while (done < c->out_len) {
+    ssize_t put = write(c->fd, c->out + done, c->out_len - done);
+    if (put > 0) {
+      done += put;
+    } else if (put < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      break;
+    } else if (put < 0 && errno != EINTR) {
+      return -1;
+    }
+  }
+
+  if (done > 0) {
+    c->out_len -= done;
+    memmove(c->out, c->out + done, c->out_len);
+  }
+  return 0;
+}
+
+void closeClient(int epfd, Client* c) {
+  epoll_ctl(epfd, EPOLL_CTL_DEL, c->fd, NULL);
+  close(c->fd);
+  free(c->out);
+  free(c);
+}
@@ -0,0 +1,264 @@
+/*
+ *  Scripted client for the RAVL tree server.
+ *
+ *  Usage: RAVL_tree_server_tester server_binary [requests]
+ *
+ *  Starts 'server_binary' on a fresh socket and talks to it in the binary
+ *  protocol described in RAVL_tree_server.c, checking every response
+ *  against a local RAVL tree that applies the same requests:
+ *    - single requests of every command, and an unknown command
+ *    - a request split over two writes
+ *    - 'requests' (default 300000) random requests pipelined without
+ *      waiting for responses, which is more than OUT_LIMIT worth of
+ *      responses, so the server has to pause reading and resume
+ *    - a batch followed at once by shutdown(SHUT_WR), after which every
+ *      response must still arrive before the server closes the connection
+ *  The random requests are seeded from RAVL_TEST_SEED. Exits with status 1
+ *  on the first failure.
+ *
+ *  Build: gcc -O2 RAVL_tree_server_tester.c RAVL_tree.c
+ *         (and the server: gcc -O2 -o server RAVL_tree_server.c RAVL_tree.c)
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "RAVL_tree.h"
+#include "RAVL_test.h"
+
+// the protocol, as defined in RAVL_tree_server.c
+#define REQ_SIZE 5
+#define RESP_SIZE 6
+#define ST_OK 0
+#define ST_NOTIN 1
+#define ST_BADCMD 2
+
+#define KEYS 10000  // keys drawn from 0 .. KEYS - 1
+
+RAVL_Node* model;  // what the server's tree should hold
+char socket_path[108];
+
+pid_t startServer(const char* binary);
+int connectServer(void);
+void request(char* req, char cmd, int32_t arg);
+void expect(const char* req, const char* resp);
+void checkSingle(void);
+void checkSplit(void);
+void checkPipelined(int n, int half_close);
+
+int main(int argc, char* argv[]) {
+  if (argc < 2) {
+    fprintf(stderr, "Usage: %s server_binary [requests]\n", argv[0]);
+    return 1;
+  }
+  testSeed();
+  int n = argc > 2 ? atoi(argv[2]) : 300000;
+
+  signal(SIGPIPE, SIG_IGN);
+  snprintf(socket_path, sizeof(socket_path), "/tmp/ravl_server_tester.%d.sock", (int)getpid());
+  pid_t server = startServer(argv[1]);
+
+  checkSingle();
+  checkSplit();
+  checkPipelined(n, 0);
+  checkPipelined(1000, 1);
+  checkPipelined(n, 1);
+
+  kill(server, SIGTERM);
+  waitpid(server, NULL, 0);
+  unlink(socket_path);
+  deleteTree(model);
+  printf("ok\n");
+  return 0;
+}
+
+/* Starts the server on 'socket_path', with its output discarded, and
+ * returns its process id once it accepts connections.
+ */
+pid_t startServer(const char* binary) {
+  pid_t pid = fork();
+  CHECK(pid >= 0);
+  if (pid == 0) {
+    int null = open("/dev/null", O_WRONLY);
+    dup2(null, STDOUT_FILENO);
+    execl(binary, binary, socket_path, (char*)NULL);
+    _exit(127);
+  }
+
+  for (int tries = 0; tries < 500; tries++) {
+    int fd = connectServer();
+    if (fd >= 0) {
+      close(fd);
+      return pid;
+    }
+    CHECK(waitpid(pid, NULL, WNOHANG) == 0);  // the server must not have died
+    usleep(10000);
+  }
+  CHECK(!"the server did not start listening");
+  return -1;
+}
+
+/* Returns a socket connected to the server, or -1. */
+int connectServer(void) {
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, socket_path);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  CHECK(fd >= 0);
+  if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+void request(char* req, char cmd, int32_t arg) {
+  req[0] = cmd;
+  memcpy(req + 1, &arg, sizeof(arg));
+}
+
+/* Checks the server's response 'resp' to 'req' against the model, and
+ * applies 'req' to the model.
+ */
+void expect(const char* req, const char* resp) {
+  char cmd = req[0];
+  int32_t arg, result = 0;
+  char status = ST_OK;
+  RAVL_Node* node;
+
+  memcpy(&arg, req + 1, sizeof(arg));
+  if (cmd == 's') {
+    node = search(model, arg);
+    if (node != NULL) {
+      result = node->key;
+    } else {
+      status = ST_NOTIN;
+    }
+  } else if (cmd == 'i') {
+    model = insert(model, arg, NULL);
+    result = model == NULL ? 0 : model->size;
+  } else if (cmd == 'd') {
+    model = delete(model, arg);
+    result = model == NULL ? 0 : model->size;
+  } else if (cmd == 'r') {
+    result = rank(model, arg);
+    if (result == NOTIN) {
+      status = ST_NOTIN;
+    }
+  } else if (cmd == 'f') {
+    node = findRank(model, arg);
+    if (node != NULL) {
+      result = node->key;
+    } else {
+      status = ST_NOTIN;
+    }
+  } else {
+    status = ST_BADCMD;
+  }
+
+  int32_t got;
+  memcpy(&got, resp + 2, sizeof(got));
+  CHECK(resp[0] == cmd);
+  CHECK(resp[1] == status);
+  CHECK(status == ST_BADCMD || got == result);
+}
+
+/* Sends 'req' and checks the response, with blocking I/O. */
+void roundTrip(int fd, const char* req) {
+  char resp[RESP_SIZE];
+  CHECK(write(fd, req, REQ_SIZE) == REQ_SIZE);
+  CHECK(recv(fd, resp, RESP_SIZE, MSG_WAITALL) == RESP_SIZE);
+  expect(req, resp);
+}
+
+void checkSingle(void) {
+  int fd = connectServer();
+  CHECK(fd >= 0);
+  char req[REQ_SIZE];
+  const char* script = "sidrfisrfdsrfx";
+  for (int i = 0; script[i] != '\0'; i++) {
+    request(req, script[i], script[i] == 'f' ? 1 : 42);
+    roundTrip(fd, req);
+  }
+  close(fd);
+}
+
+void checkSplit(void) {
+  int fd = connectServer();
+  CHECK(fd >= 0);
+  char req[REQ_SIZE], resp[RESP_SIZE];
+  request(req, 'i', 7);
+  CHECK(write(fd, req, 2) == 2);
+  usleep(20000);  // let the server read the first part on its own
+  CHECK(write(fd, req + 2, REQ_SIZE - 2) == REQ_SIZE - 2);
+  CHECK(recv(fd, resp, RESP_SIZE, MSG_WAITALL) == RESP_SIZE);
+  expect(req, resp);
+  close(fd);
+}
+
+/* Sends 'n' random requests without waiting for their responses, reading
+ * responses whenever they arrive, then checks them all. With 'half_close',
+ * shuts down the writing side after the last request and expects the
+ * server to close the connection once every response is sent.
+ */
+void checkPipelined(int n, int half_close) {
+  char* reqs = (char*)malloc((size_t)n * REQ_SIZE);
+  char* resps = (char*)malloc((size_t)n * RESP_SIZE + 1);
+  CHECK(reqs != NULL && resps != NULL);
+  unsigned seed = test_seed * 1000 + (unsigned)n + (unsigned)half_close;
+  for (int i = 0; i < n; i++) {
+    unsigned r = testRandom(&seed);
+    const char* cmds = "ssiiiddrrf";
+    char cmd = r % 997 == 0 ? '?' : cmds[(r >> 16) % 10];
+    int32_t arg = cmd == 'f' ? (int32_t)(r % (KEYS + 2)) : (int32_t)(r % KEYS);
+    request(reqs + (size_t)i * REQ_SIZE, cmd, arg);
+  }
+
+  int fd = connectServer();
+  CHECK(fd >= 0);
+  CHECK(fcntl(fd, F_SETFL, O_NONBLOCK) == 0);
+  size_t sent = 0, got = 0, to_send = (size_t)n * REQ_SIZE, to_get = (size_t)n * RESP_SIZE;
+  int closed = 0;
+  while (got < to_get || (half_close && !closed)) {
+    struct pollfd p = {fd, POLLIN | (sent < to_send ? POLLOUT : 0), 0};
+    CHECK(poll(&p, 1, 10000) == 1);  // a stall of 10 s means a deadlock
+    if (p.revents & POLLOUT) {
+      ssize_t put = write(fd, reqs + sent, to_send - sent);
+      CHECK(put > 0 || errno == EAGAIN);
+      sent += put > 0 ? (size_t)put : 0;
+      if (sent == to_send && half_close) {
+        CHECK(shutdown(fd, SHUT_WR) == 0);
+      }
+    }
+    if (p.revents & (POLLIN | POLLHUP)) {
+      // read one byte past the end to see a response that should not exist
+      ssize_t in = read(fd, resps + got, to_get + 1 - got);
+      CHECK(in >= 0 || errno == EAGAIN);
+      if (in == 0) {
+        closed = 1;
+        CHECK(half_close);  // the server only closes after a half-close
+        break;
+      }
+      got += in > 0 ? (size_t)in : 0;
+      CHECK(got <= to_get);
+    }
+  }
+  CHECK(got == to_get);
+  close(fd);
+
+  for (int i = 0; i < n; i++) {
+    expect(reqs + (size_t)i * REQ_SIZE, resps + (size_t)i * RESP_SIZE);
+  }
+  free(reqs);
+  free(resps);
+}